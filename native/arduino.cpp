@@ -0,0 +1,105 @@
+/*
+This file contains the Arduino core functions of the host build, see include/Arduino.h and native.h.
+*/
+#include "native.h"
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <chrono>
+#include <signal.h>
+#include <vector>
+
+HardwareSerial Serial, Serial1, Serial2;
+EspClass ESP;
+fs::FS SPIFFS;
+WiFiClass WiFi;
+
+uint32_t i_nativeMillis;
+uint8_t pinLevels[64];
+std::vector<std::pair<TaskFunction_t, void *>> nativeTasks;
+
+static uint64_t realNanos()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint32_t millis(){ return i_nativeMillis; }
+uint32_t micros(){ return realNanos() / 1000; }
+void delay( uint32_t ms ){ i_nativeMillis += ms; }
+void yield(){}
+
+void pinMode( uint8_t, uint8_t ){}
+void digitalWrite( uint8_t pin, uint8_t level ){ pinLevels[pin % sizeof(pinLevels)] = level; }
+int digitalRead( uint8_t pin ){ return pinLevels[pin % sizeof(pinLevels)]; }
+
+uint32_t EspClass::getCycleCount(){ return static_cast<uint32_t>(realNanos()); }
+void EspClass::restart(){ exit(0); }
+
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t task, const char *, uint32_t, void *parameter, unsigned, TaskHandle_t *handle, int )
+{
+	nativeTasks.emplace_back(task, parameter);
+	if ( handle )
+		*handle = reinterpret_cast<TaskHandle_t>(nativeTasks.size());
+	return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(){ return nullptr; }
+void vTaskDelete( TaskHandle_t ){}
+
+void nativeStartFirmware()
+{
+	setup();
+	nativeRunTasks();
+	loop();
+	Serial2.inject("$0=10\r\nok\r\n"); //a short listing, anything else is left at its fallback
+	loop();
+	Serial.takeOutput();
+	Serial2.takeOutput();
+}
+
+void nativeSetMillis( uint32_t ms ){ i_nativeMillis = ms; }
+
+void nativeRunMillis( uint32_t ms )
+{
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		i_nativeMillis++;
+		loop();
+	}
+}
+
+void nativeRunTasks()
+{
+	while ( nativeTasks.size() )
+	{
+		auto task = nativeTasks.front();
+		nativeTasks.erase(nativeTasks.begin());
+		task.first(task.second);
+	}
+}
+
+uint8_t nativePinLevel( uint8_t pin ){ return pinLevels[pin % sizeof(pinLevels)]; }
+
+std::string escapeBytes( const std::string &data )
+{
+	std::string out;
+	for ( unsigned char c : data )
+	{
+		if ( c == '\n' )
+			out += "\\n";
+		else if ( c == '\r' )
+			out += "\\r";
+		else if ( c < 0x20 || c >= 0x7F || c == '\\' )
+		{
+			char hex[5];
+			snprintf(hex, sizeof(hex), "\\x%02x", c);
+			out += hex;
+		}
+		else
+			out += static_cast<char>(c);
+	}
+	return out;
+}
+
+//A watcher that goes away mid-write must not take the process with it, lwIP just returns an error.
+static const bool b_sigpipeIgnored = signal(SIGPIPE, SIG_IGN) != SIG_ERR;
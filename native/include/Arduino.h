@@ -0,0 +1,301 @@
+/*
+This file contains the part of the Arduino core that the firmware uses, for building it on a Linux host (see CMakeLists.txt).
+It is only as complete as the firmware needs it to be. String follows the ESP-32 core: numbers are appended as numbers
+(uint8_t included), chars as chars, and floats with two decimals unless told otherwise.
+
+millis() is a virtual clock that only moves when the test or tool moves it (see native.h), so everything that the firmware
+times runs the same way on every run. micros() and ESP.getCycleCount() are real, they are only ever used to measure how long
+the firmware itself takes.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define uint_fast32_t uint32_t //as on the ESP-32, the settings take uint32_t variables as uint_fast32_t
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+inline bool isDigit( int c ){ return c >= '0' && c <= '9'; }
+inline bool isAlpha( int c ){ return isalpha(c); }
+inline bool isSpace( int c ){ return isspace(c); }
+
+uint32_t millis();
+uint32_t micros();
+void delay( uint32_t ms );
+void yield();
+void pinMode( uint8_t pin, uint8_t mode );
+void digitalWrite( uint8_t pin, uint8_t level );
+int digitalRead( uint8_t pin );
+
+void setup();
+void loop();
+
+class String
+{
+public:
+	String(){}
+	String( const char *c ){ if ( c ) s = c; }
+	String( const std::string &c ) : s(c) {}
+	explicit String( char c ) : s(1, c) {}
+	explicit String( unsigned char value, unsigned char base = DEC ){ s = number(value, base); }
+	explicit String( int value, unsigned char base = DEC ){ s = value < 0 && base == DEC ? "-" + number(-static_cast<long long>(value), base) : number(static_cast<unsigned>(value), base); }
+	explicit String( unsigned int value, unsigned char base = DEC ){ s = number(value, base); }
+	explicit String( long value, unsigned char base = DEC ){ s = value < 0 && base == DEC ? "-" + number(-static_cast<long long>(value), base) : number(static_cast<unsigned long>(value), base); }
+	explicit String( unsigned long value, unsigned char base = DEC ){ s = number(value, base); }
+	explicit String( long long value, unsigned char base = DEC ){ s = value < 0 && base == DEC ? "-" + number(-value, base) : number(static_cast<unsigned long long>(value), base); }
+	explicit String( unsigned long long value, unsigned char base = DEC ){ s = number(value, base); }
+	explicit String( float value, unsigned int decimals = 2 ){ s = fixed(value, decimals); }
+	explicit String( double value, unsigned int decimals = 2 ){ s = fixed(value, decimals); }
+
+	unsigned int length() const { return s.size(); }
+	bool isEmpty() const { return s.empty(); }
+	const char *c_str() const { return s.c_str(); }
+	char *begin(){ return &s[0]; }
+	char *end(){ return &s[0] + s.size(); }
+	const char *begin() const { return s.c_str(); }
+	const char *end() const { return s.c_str() + s.size(); }
+
+	char charAt( unsigned int index ) const { return index < s.size() ? s[index] : 0; }
+	void setCharAt( unsigned int index, char c ){ if ( index < s.size() ) s[index] = c; }
+	char operator[]( unsigned int index ) const { return charAt(index); }
+	char &operator[]( unsigned int index ){ static char dummy; if ( index < s.size() ) return s[index]; dummy = 0; return dummy; }
+
+	bool reserve( unsigned int size ){ s.reserve(size); return true; }
+	void clear(){ s.clear(); }
+
+	bool concat( const String &str ){ s += str.s; return true; }
+	bool concat( const char *str ){ if ( str ) s += str; return true; }
+	bool concat( const char *str, unsigned int length ){ if ( str ) s.append(str, length); return true; }
+	bool concat( char c ){ s += c; return true; }
+	bool concat( unsigned char value ){ s += number(value, DEC); return true; }
+	bool concat( int value ){ return concat(String(value)); }
+	bool concat( unsigned int value ){ return concat(String(value)); }
+	bool concat( long value ){ return concat(String(value)); }
+	bool concat( unsigned long value ){ return concat(String(value)); }
+	bool concat( long long value ){ return concat(String(value)); }
+	bool concat( unsigned long long value ){ return concat(String(value)); }
+	bool concat( float value ){ return concat(String(value)); }
+	bool concat( double value ){ return concat(String(value)); }
+
+	template <typename T> String &operator+=( const T &value ){ concat(value); return *this; }
+
+	int compareTo( const String &str ) const { return s.compare(str.s); }
+	bool equals( const String &str ) const { return s == str.s; }
+	bool equalsIgnoreCase( const String &str ) const
+	{
+		return s.size() == str.s.size() && std::equal(s.begin(), s.end(), str.s.begin(), []( char a, char b ){ return tolower(a) == tolower(b); });
+	}
+	bool operator==( const String &str ) const { return s == str.s; }
+	bool operator==( const char *str ) const { return s == (str ? str : ""); }
+	bool operator!=( const String &str ) const { return s != str.s; }
+	bool operator!=( const char *str ) const { return !(*this == str); }
+	bool operator<( const String &str ) const { return s < str.s; }
+	bool operator>( const String &str ) const { return s > str.s; }
+	bool operator<=( const String &str ) const { return s <= str.s; }
+	bool operator>=( const String &str ) const { return s >= str.s; }
+
+	bool startsWith( const String &prefix ) const { return s.compare(0, prefix.s.size(), prefix.s) == 0; }
+	bool startsWith( const String &prefix, unsigned int offset ) const { return offset <= s.size() && s.compare(offset, prefix.s.size(), prefix.s) == 0; }
+	bool endsWith( const String &suffix ) const { return s.size() >= suffix.s.size() && s.compare(s.size() - suffix.s.size(), suffix.s.size(), suffix.s) == 0; }
+
+	int indexOf( char c, unsigned int from = 0 ) const { return found(s.find(c, from)); }
+	int indexOf( const String &str, unsigned int from = 0 ) const { return found(s.find(str.s, from)); }
+	int lastIndexOf( char c ) const { return found(s.rfind(c)); }
+	int lastIndexOf( char c, unsigned int from ) const { return found(s.rfind(c, from)); }
+	int lastIndexOf( const String &str ) const { return found(s.rfind(str.s)); }
+
+	String substring( unsigned int from ) const { return from < s.size() ? String(s.substr(from)) : String(); }
+	String substring( unsigned int from, unsigned int to ) const
+	{
+		if ( from > to )
+			std::swap(from, to);
+		return from < s.size() ? String(s.substr(from, to - from)) : String();
+	}
+
+	void replace( char find, char replace ){ std::replace(s.begin(), s.end(), find, replace); }
+	void replace( const String &find, const String &replace )
+	{
+		if ( find.s.empty() )
+			return;
+		for ( size_t at = s.find(find.s); at != std::string::npos; at = s.find(find.s, at + replace.s.size()) )
+			s.replace(at, find.s.size(), replace.s);
+	}
+	void remove( unsigned int index ){ if ( index < s.size() ) s.erase(index); }
+	void remove( unsigned int index, unsigned int count ){ if ( index < s.size() ) s.erase(index, count); }
+	void toLowerCase(){ for ( char &c : s ) c = tolower(c); }
+	void toUpperCase(){ for ( char &c : s ) c = toupper(c); }
+	void trim()
+	{
+		size_t first = 0;
+		while ( first < s.size() && isspace(static_cast<unsigned char>(s[first])) )
+			first++;
+		size_t last = s.size();
+		while ( last > first && isspace(static_cast<unsigned char>(s[last - 1])) )
+			last--;
+		s = s.substr(first, last - first);
+	}
+
+	long toInt() const { return atol(s.c_str()); }
+	float toFloat() const { return atof(s.c_str()); }
+	double toDouble() const { return atof(s.c_str()); }
+
+private:
+	std::string s;
+
+	static int found( size_t at ){ return at == std::string::npos ? -1 : static_cast<int>(at); }
+	static std::string number( unsigned long long value, unsigned char base )
+	{
+		std::string out;
+		do
+		{
+			out.insert(out.begin(), "0123456789abcdefghijklmnopqrstuvwxyz"[value % base]);
+			value /= base;
+		} while ( value );
+		return out;
+	}
+	static std::string fixed( double value, unsigned int decimals )
+	{
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+		return buffer;
+	}
+};
+
+//As in the ESP-32 core, anything that String::concat() takes can be added to a String, and a String can be added to a literal.
+template <typename T> String operator+( const String &lhs, const T &rhs ){ String out(lhs); out.concat(rhs); return out; }
+inline String operator+( const char *lhs, const String &rhs ){ String out(lhs); out.concat(rhs); return out; }
+inline String operator+( char lhs, const String &rhs ){ String out(lhs); out.concat(rhs); return out; }
+inline bool operator==( const char *lhs, const String &rhs ){ return rhs == lhs; }
+inline bool operator!=( const char *lhs, const String &rhs ){ return rhs != lhs; }
+
+class Print
+{
+public:
+	virtual ~Print(){}
+	virtual size_t write( uint8_t c ) = 0;
+	virtual size_t write( const uint8_t *buffer, size_t size )
+	{
+		for ( size_t x = 0; x < size; x++ )
+			write(buffer[x]);
+		return size;
+	}
+	size_t write( const char *str ){ return str ? write(reinterpret_cast<const uint8_t *>(str), strlen(str)) : 0; }
+	size_t write( const char *buffer, size_t size ){ return write(reinterpret_cast<const uint8_t *>(buffer), size); }
+
+	size_t print( const String &str ){ return write(reinterpret_cast<const uint8_t *>(str.c_str()), str.length()); }
+	size_t print( const char *str ){ return write(str); }
+	size_t print( char c ){ return write(static_cast<uint8_t>(c)); }
+	template <typename T> size_t print( T value, int base = DEC ){ return print(String(value, base)); }
+	size_t print( double value, int decimals = 2 ){ return print(String(value, decimals)); }
+	size_t println(){ return print("\r\n"); }
+	template <typename T> size_t println( const T &value ){ return print(value) + println(); }
+	void flush(){}
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout( unsigned long ){}
+	size_t readBytes( uint8_t *buffer, size_t length )
+	{
+		size_t count = 0;
+		for ( int c; count < length && (c = read()) >= 0; )
+			buffer[count++] = static_cast<uint8_t>(c);
+		return count;
+	}
+	size_t readBytes( char *buffer, size_t length ){ return readBytes(reinterpret_cast<uint8_t *>(buffer), length); }
+	String readString()
+	{
+		String out;
+		for ( int c; (c = read()) >= 0; )
+			out += static_cast<char>(c);
+		return out;
+	}
+	String readStringUntil( char terminator )
+	{
+		String out;
+		for ( int c; (c = read()) >= 0 && c != terminator; )
+			out += static_cast<char>(c);
+		return out;
+	}
+};
+
+//A serial port with nothing on the other end but the test or tool, which puts in what the device "receives" and takes out what it sent.
+class HardwareSerial : public Stream
+{
+public:
+	void begin( unsigned long ){}
+	void end(){}
+	int available() override { return rx.size() - i_rxPos; }
+	int read() override { return i_rxPos < rx.size() ? static_cast<uint8_t>(rx[i_rxPos++]) : -1; }
+	int peek() override { return i_rxPos < rx.size() ? static_cast<uint8_t>(rx[i_rxPos]) : -1; }
+	int availableForWrite(){ return 128; }
+	size_t write( uint8_t c ) override { tx += static_cast<char>(c); return 1; }
+	size_t write( const uint8_t *buffer, size_t size ) override { tx.append(reinterpret_cast<const char *>(buffer), size); return size; }
+	using Print::write;
+	operator bool() const { return true; }
+
+	//Native only
+	void inject( const std::string &data ){ rx.erase(0, i_rxPos); i_rxPos = 0; rx += data; }
+	std::string takeOutput(){ std::string out; out.swap(tx); return out; }
+
+private:
+	std::string rx, tx;
+	size_t i_rxPos = 0;
+};
+
+extern HardwareSerial Serial, Serial1, Serial2;
+
+class EspClass
+{
+public:
+	uint32_t getCycleCount(); //counts nanoseconds, at the 1000 MHz reported below
+	uint32_t getCpuFreqMHz(){ return 1000; }
+	uint32_t getFreeHeap(){ return 0; }
+	void restart();
+};
+
+extern EspClass ESP;
+
+//FreeRTOS, as far as the boot task needs it. Tasks are run when the test or tool calls nativeRunTasks().
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)( void * );
+typedef int BaseType_t;
+#define pdPASS 1
+
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t task, const char *name, uint32_t stack, void *parameter, unsigned priority, TaskHandle_t *handle, int core );
+TaskHandle_t xTaskGetCurrentTaskHandle();
+void vTaskDelete( TaskHandle_t task );
@@ -0,0 +1,18 @@
+//Classic Bluetooth SPP for the host build. A host is "connected" once the test or tool calls setClient(true).
+#pragma once
+#include "Arduino.h"
+
+class BluetoothSerial : public HardwareSerial
+{
+public:
+	bool begin( const String &name ){ s_name = name; return true; }
+	bool setPin( const char * ){ return true; }
+	bool hasClient(){ return b_client; }
+
+	//Native only
+	void setClient( bool connected ){ b_client = connected; }
+
+private:
+	String s_name;
+	bool b_client = false;
+};
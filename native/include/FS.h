@@ -0,0 +1,103 @@
+//The SPIFFS file API for the host build. Files live in memory, and only for as long as the process runs.
+#pragma once
+#include "Arduino.h"
+#include <map>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode
+{
+	SeekSet,
+	SeekCur,
+	SeekEnd,
+};
+
+class File : public Stream
+{
+public:
+	File(){}
+	File( std::shared_ptr<std::string> data, const char *mode ) : data(data), b_write(mode[0] != 'r'), i_pos(mode[0] == 'a' ? data->size() : 0) {}
+
+	explicit operator bool() const { return data != nullptr; }
+	void close(){ data.reset(); }
+	size_t size() const { return data ? data->size() : 0; }
+	size_t position() const { return i_pos; }
+	bool seek( uint32_t pos, SeekMode mode = SeekSet )
+	{
+		size_t base = mode == SeekSet ? 0 : (mode == SeekCur ? i_pos : size());
+		if ( !data || base + pos > data->size() )
+			return false;
+		i_pos = base + pos;
+		return true;
+	}
+
+	int available() override { return data ? data->size() - i_pos : 0; }
+	int read() override { return data && i_pos < data->size() ? static_cast<uint8_t>((*data)[i_pos++]) : -1; }
+	int peek() override { return data && i_pos < data->size() ? static_cast<uint8_t>((*data)[i_pos]) : -1; }
+	size_t read( uint8_t *buffer, size_t length ){ return readBytes(buffer, length); }
+	size_t write( uint8_t c ) override { return write(&c, 1); }
+	size_t write( const uint8_t *buffer, size_t length ) override
+	{
+		if ( !data || !b_write )
+			return 0;
+		data->replace(i_pos, std::min(length, data->size() - i_pos), reinterpret_cast<const char *>(buffer), length);
+		i_pos += length;
+		return length;
+	}
+	using Print::write;
+
+private:
+	std::shared_ptr<std::string> data;
+	bool b_write = false;
+	size_t i_pos = 0;
+};
+
+class FS
+{
+public:
+	bool begin( bool formatOnFail = false ){ (void)formatOnFail; return true; }
+	void end(){}
+	bool format(){ files.clear(); return true; }
+	size_t totalBytes(){ return 1441792; } //the SPIFFS partition of default.csv
+	size_t usedBytes()
+	{
+		size_t used = 0;
+		for ( auto &file : files )
+			used += file.second->size();
+		return used;
+	}
+
+	File open( const String &path, const char *mode = FILE_READ )
+	{
+		auto file = files.find(path.c_str());
+		if ( mode[0] == 'r' )
+			return file == files.end() ? File() : File(file->second, mode);
+		if ( file == files.end() || mode[0] == 'w' )
+			file = files.insert_or_assign(path.c_str(), std::make_shared<std::string>()).first;
+		return File(file->second, mode);
+	}
+	bool exists( const String &path ){ return files.count(path.c_str()); }
+	bool remove( const String &path ){ return files.erase(path.c_str()); }
+	bool rename( const String &from, const String &to )
+	{
+		auto file = files.find(from.c_str());
+		if ( file == files.end() )
+			return false;
+		files[to.c_str()] = file->second;
+		files.erase(file);
+		return true;
+	}
+
+private:
+	std::map<std::string, std::shared_ptr<std::string>> files;
+};
+
+}
+
+using fs::File;
@@ -0,0 +1,76 @@
+/*
+WiFi for the host build. The station is "connected" as soon as it is started, and the server is a real TCP server on the
+loopback interface, so that a test can connect to it with ordinary sockets.
+*/
+#pragma once
+#include "Arduino.h"
+#include <memory>
+
+#define WIFI_OFF 0
+#define WIFI_STA 1
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+class IPAddress
+{
+public:
+	String toString() const { return PSTR("127.0.0.1"); }
+};
+
+class WiFiClient : public Stream
+{
+public:
+	WiFiClient(){}
+	explicit WiFiClient( int fd );
+
+	int fd() const { return socket ? *socket : -1; }
+	bool connected();
+	void stop(){ socket.reset(); }
+	explicit operator bool() const { return socket != nullptr; }
+
+	int available() override;
+	int read() override;
+	int read( uint8_t *buffer, size_t length );
+	int peek() override { return -1; }
+	size_t write( uint8_t c ) override { return write(&c, 1); }
+	size_t write( const uint8_t *buffer, size_t length ) override;
+	using Print::write;
+
+private:
+	std::shared_ptr<int> socket; //closed once the last copy is gone, as on the ESP-32
+};
+
+class WiFiServer
+{
+public:
+	explicit WiFiServer( uint16_t port ) : i_port(port) {}
+	void begin();
+	void end();
+	void setNoDelay( bool ){}
+	bool hasClient();
+	WiFiClient available();
+
+private:
+	uint16_t i_port;
+	int i_listen = -1,
+		i_accepted = -1; //taken by hasClient(), handed out by available()
+};
+
+class WiFiClass
+{
+public:
+	bool mode( uint8_t m ){ i_mode = m; return true; }
+	uint8_t getMode() const { return i_mode; }
+	bool setAutoReconnect( bool ){ return true; }
+	int begin( const char *ssid, const char *password ){ (void)ssid; (void)password; i_status = WL_CONNECTED; return i_status; }
+	bool disconnect( bool wifiOff = false ){ (void)wifiOff; i_status = WL_DISCONNECTED; return true; }
+	int status() const { return i_status; }
+	IPAddress localIP() const { return IPAddress(); }
+
+private:
+	uint8_t i_mode = WIFI_OFF;
+	int i_status = WL_IDLE_STATUS;
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,4 @@
+//lwIP's BSD socket API is the one the host already has.
+#pragma once
+#include <errno.h>
+#include <sys/socket.h>
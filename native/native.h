@@ -0,0 +1,18 @@
+/*
+This file contains what the host build adds to the Arduino API, for the tools and tests that drive the firmware on Linux.
+Everything else the firmware touches (serial ports, SPIFFS, WiFi) is reached through the usual Arduino objects.
+*/
+#pragma once
+#include <Arduino.h>
+#include <BluetoothSerial.h>
+#include <string>
+
+void nativeStartFirmware(); //setup(), the background initialization and the first loop(), with whatever they sent dropped, and
+							//GRBL's answer to the settings request
+void nativeSetMillis( uint32_t ms );
+void nativeRunMillis( uint32_t ms ); //moves the clock on one msec at a time, with a loop() for each
+void nativeRunTasks(); //runs the tasks that have been started, each one to its end
+uint8_t nativePinLevel( uint8_t pin );
+std::string escapeBytes( const std::string &data ); //for printing, anything unprintable is shown as \xNN
+
+extern BluetoothSerial BtSerial;
@@ -0,0 +1,110 @@
+/*
+This file contains the WiFi server and client of the host build, on real loopback sockets (see include/WiFi.h).
+*/
+#include <WiFi.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define WIFI_SEND_BUFFER 5744 //bytes, lwIP's TCP send buffer on the ESP-32
+
+WiFiClient::WiFiClient( int fd ) : socket(new int(fd), []( int *fd ){ close(*fd); delete fd; }) {}
+
+bool WiFiClient::connected()
+{
+	if ( !socket )
+		return false;
+
+	char c;
+	ssize_t peeked = recv(*socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return peeked > 0 || (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int WiFiClient::available()
+{
+	int count = 0;
+	if ( !socket || ioctl(*socket, FIONREAD, &count) < 0 )
+		return 0;
+	return count;
+}
+
+int WiFiClient::read()
+{
+	uint8_t c;
+	return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read( uint8_t *buffer, size_t length )
+{
+	if ( !socket )
+		return -1;
+	return recv(*socket, buffer, length, MSG_DONTWAIT);
+}
+
+size_t WiFiClient::write( const uint8_t *buffer, size_t length )
+{
+	if ( !socket )
+		return 0;
+	ssize_t sent = send(*socket, buffer, length, MSG_DONTWAIT);
+	return sent < 0 ? 0 : sent;
+}
+
+void WiFiServer::begin()
+{
+	if ( i_listen >= 0 )
+		return;
+
+	i_listen = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(i_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(i_port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ( bind(i_listen, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(i_listen, 4) < 0 )
+	{
+		perror("WiFiServer");
+		end();
+		return;
+	}
+	fcntl(i_listen, F_SETFL, fcntl(i_listen, F_GETFL) | O_NONBLOCK);
+}
+
+void WiFiServer::end()
+{
+	if ( i_accepted >= 0 )
+		close(i_accepted);
+	if ( i_listen >= 0 )
+		close(i_listen);
+	i_accepted = i_listen = -1;
+}
+
+bool WiFiServer::hasClient()
+{
+	if ( i_accepted < 0 && i_listen >= 0 )
+	{
+		i_accepted = accept(i_listen, nullptr, nullptr);
+		if ( i_accepted >= 0 )
+		{
+			int on = 1, sendBuffer = WIFI_SEND_BUFFER;
+			setsockopt(i_accepted, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			setsockopt(i_accepted, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer)); //so that a client that doesn't read fills it as soon
+		}
+	}
+	return i_accepted >= 0;
+}
+
+WiFiClient WiFiServer::available()
+{
+	if ( !hasClient() )
+		return WiFiClient();
+
+	WiFiClient client(i_accepted);
+	i_accepted = -1;
+	return client;
+}
@@ -0,0 +1,297 @@
+/*
+This file contains the line acknowledgement tracker. Every line sent to GRBL gets an id and a send time, and is matched (first in, first out)
+against the "ok" and "error:" replies. This gives the round trip latency of each line, and lets us notice when GRBL stops answering.
+
+GRBL only answers a line once there is room for it in the planner, so a long move or a G4 dwell holds back the "ok" for the lines behind
+it, for as long as it takes. A line that has waited STALL msec is therefore not a stall on its own. GRBL is asked for a status report
+first (unless one arrived recently), and the stall is only declared if it doesn't answer, or if it says it is running but hasn't moved
+since the previous time we looked. Otherwise the wait starts over. The reply to our own request never reaches the host.
+*/
+#include "globaldefs.h"
+
+#define ACK_TRACKER_SIZE 64 //lines that may be in flight at once, GRBL's RX buffer is only 128 bytes.
+#define ACK_LATENCY_HISTORY 64 //latencies kept for the rolling percentiles
+#define ACK_SETTING_LINE_MAX 48 //longest $n=value line kept for the settings mirror
+#define STALL_PROBE_TIMEOUT 1000 //msec GRBL has to answer a status request before it is stuck, a status report this recent is an answer
+
+const String &MSG_STALL PROGMEM = PSTR("[MSG:No reply from GRBL for "),
+			 &MSG_STALL_CLEARED PROGMEM = PSTR("[MSG:GRBL is responding again]"),
+			 &MSG_SLO PROGMEM = PSTR("[MSG:Line latency p95 above "),
+			 &MSG_MSEC PROGMEM = PSTR(" msec");
+
+//A line that has been sent to GRBL, and is waiting for its reply.
+struct AckEntry
+{
+	uint32_t i_id,
+			 i_sentMillis;
+	bool b_internal; //sent by the ESP-32 itself, the reply must not reach the host.
+	uint8_t i_merged; //replies owed for the host lines the optimizer joined into this one, answered along with it
+	uint16_t i_length; //bytes it takes up in GRBL's receive buffer, with its line end
+	bool b_settingWrite; //a $n=value line, the settings mirror is waiting for its reply
+};
+
+AckEntry ackEntries[ACK_TRACKER_SIZE];
+uint8_t i_ackHead,
+		i_ackCount;
+uint16_t i_ackBytes, //bytes of the lines in flight
+		 i_ackPartialBytes; //bytes sent since the last line end
+uint32_t i_ackNextID;
+String s_ackLine; //the line being sent, only kept if it starts with '$'
+
+uint32_t ackLatencies[ACK_LATENCY_HISTORY], //msec, in the order they arrived
+		 sortedLatencies[ACK_LATENCY_HISTORY]; //the same ones kept in order, so that a percentile is a lookup
+uint8_t i_latencyCount,
+		i_latencyPos;
+uint32_t i_latencyMax,
+		 i_stallCount;
+
+bool b_ackStalled,
+	 b_ackSloExceeded,
+	 b_stallLightsEnabled; //state of the lights before we started flashing them
+uint32_t i_stallFlashMillis,
+		 i_stallCheckMillis, //when a line that was taking long was last found to be waiting on a GRBL that is alive
+		 i_stallProbeMillis; //when we asked GRBL for a status report, 0 if we haven't
+uint8_t i_statusProbes; //status reports we asked for, that haven't arrived yet
+float f_stallMPos[3]; //where GRBL was at i_stallCheckMillis
+
+void resetAckTracker()
+{
+	i_ackHead = 0;
+	i_ackCount = 0;
+	i_ackBytes = 0;
+	i_ackPartialBytes = 0;
+	s_ackLine.clear();
+	clearSettingWrites();
+	b_ackStalled = false; //nothing left to wait for
+	i_stallCheckMillis = 0;
+	i_stallProbeMillis = 0;
+	i_statusProbes = 0; //GRBL drops what it owes us when it is reset
+}
+
+//Forgets the recent latencies and stalls, so that the statistics (and the SLO) start over.
+void resetAckStats()
+{
+	i_latencyCount = 0;
+	i_latencyPos = 0;
+	i_latencyMax = 0;
+	i_stallCount = 0;
+	b_ackSloExceeded = false;
+}
+
+//Records the lines in data that have been sent to GRBL, one entry per line terminator. GRBL answers every '\r' and '\n' (even an
+//empty line), so a CRLF line is two entries.
+void trackSentLines( const String &data, bool internal, uint8_t merged )
+{
+	for ( uint16_t x = 0; x < data.length(); x++ )
+	{
+		if ( data[x] == 0x18 ) //soft reset, GRBL drops everything it was holding
+			resetAckTracker();
+
+		if ( isGrblRealtime(data[x]) )
+			continue; //realtime commands never reach GRBL's line buffer
+
+		bool lineStart = !i_ackPartialBytes;
+		i_ackPartialBytes++;
+		if ( data[x] != CHAR_NEWLINE && data[x] != CHAR_CARRIAGE )
+		{
+			if ( (lineStart && data[x] == '$') || (s_ackLine.length() && s_ackLine.length() < ACK_SETTING_LINE_MAX) )
+				s_ackLine += data[x];
+			continue;
+		}
+
+		if ( i_ackCount == ACK_TRACKER_SIZE ) //can't be tracked, and must not be counted against the buffer forever
+		{
+			i_ackPartialBytes = 0;
+			s_ackLine.clear();
+			continue;
+		}
+
+		AckEntry &entry = ackEntries[(i_ackHead + i_ackCount) % ACK_TRACKER_SIZE];
+		entry.i_id = i_ackNextID++;
+		entry.i_sentMillis = millis();
+		entry.b_internal = internal;
+		entry.i_merged = merged;
+		entry.i_length = i_ackPartialBytes;
+		entry.b_settingWrite = s_ackLine.length() && trackSettingWrite(s_ackLine);
+		s_ackLine.clear();
+		i_ackBytes += i_ackPartialBytes;
+		i_ackPartialBytes = 0;
+		i_ackCount++;
+	}
+}
+
+//Returns the p-th percentile (0-100) of the recent latencies.
+uint32_t latencyPercentile( uint8_t percentile )
+{
+	if ( !i_latencyCount )
+		return 0;
+
+	uint8_t rank = (i_latencyCount * percentile + 99) / 100; //nearest rank
+	return sortedLatencies[rank ? rank - 1 : 0];
+}
+
+//Adds a latency to the window, dropping the oldest one once it is full. Both copies are updated in place, no sorting needed.
+void recordLatency( uint32_t latency )
+{
+	uint32_t *end = sortedLatencies + i_latencyCount;
+	if ( i_latencyCount == ACK_LATENCY_HISTORY )
+	{
+		uint32_t *oldest = std::lower_bound(sortedLatencies, end, ackLatencies[i_latencyPos]);
+		memmove(oldest, oldest + 1, (end - oldest - 1) * sizeof(uint32_t));
+		end--;
+	}
+	else
+		i_latencyCount++;
+
+	uint32_t *slot = std::upper_bound(sortedLatencies, end, latency);
+	memmove(slot + 1, slot, (end - slot) * sizeof(uint32_t));
+	*slot = latency;
+
+	ackLatencies[i_latencyPos] = latency;
+	i_latencyPos = (i_latencyPos + 1) % ACK_LATENCY_HISTORY;
+	i_latencyMax = max(i_latencyMax, latency);
+}
+
+uint8_t linesInFlight()
+{
+	return i_ackCount;
+}
+
+//Bytes sent to GRBL that it hasn't answered yet, the same count a character counting sender keeps.
+uint16_t bytesInFlight()
+{
+	return i_ackBytes + i_ackPartialBytes;
+}
+
+//True if the oldest line in flight was sent by the ESP-32 itself.
+bool ackOldestInternal()
+{
+	return i_ackCount && ackEntries[i_ackHead].b_internal;
+}
+
+//Called for every "ok" or "error:" reply. Returns true if the line was sent by the ESP-32 itself. merged is set to the number of
+//host lines that were joined into it, and are still waiting for their reply, settingWrite if the line was a $n=value write.
+bool ackLineCompleted( uint8_t &merged, bool &settingWrite )
+{
+	merged = 0;
+	settingWrite = false;
+	if ( !i_ackCount )
+		return false; //sent before we started counting
+
+	AckEntry &entry = ackEntries[i_ackHead];
+	merged = entry.i_merged;
+	settingWrite = entry.b_settingWrite;
+	i_ackBytes -= entry.i_length;
+	i_ackHead = (i_ackHead + 1) % ACK_TRACKER_SIZE;
+	i_ackCount--;
+
+	recordLatency(millis() - entry.i_sentMillis);
+	i_stallProbeMillis = 0; //the next line gets a wait of its own
+
+	if ( b_ackStalled ) //GRBL is talking again
+	{
+		b_ackStalled = false;
+		if ( stall_actions & static_cast<uint8_t>(ACK_ACTION::FLASH) )
+		{
+			if ( b_stallLightsEnabled )
+				Lights.Enable();
+			else
+				Lights.Disable();
+		}
+		if ( stall_actions & static_cast<uint8_t>(ACK_ACTION::NOTIFY) )
+			printMessageToHost(MSG_STALL_CLEARED + MSG_NLCR);
+	}
+
+	if ( latency_slo )
+	{
+		bool exceeded = latencyPercentile(95) > latency_slo;
+		if ( exceeded && !b_ackSloExceeded )
+			printMessageToHost(MSG_SLO + String(latency_slo) + MSG_MSEC + ']' + MSG_NLCR);
+		b_ackSloExceeded = exceeded;
+	}
+
+	return entry.b_internal;
+}
+
+//Called once per cycle, watches the oldest line in flight and takes the configured actions when GRBL stops replying.
+void serviceAckTracker()
+{
+	if ( b_ackStalled )
+	{
+		if ( (stall_actions & static_cast<uint8_t>(ACK_ACTION::FLASH)) && millis() >= i_stallFlashMillis )
+		{
+			Lights.Toggle();
+			i_stallFlashMillis = millis() + (Lights.Enabled() ? alarm_flash_time_off : alarm_flash_time_on);
+		}
+		return;
+	}
+
+	if ( !stall_timeout || !i_ackCount )
+		return;
+
+	if ( i_grblState == GRBL_STATE::HOME_HOLD || i_grblState == GRBL_STATE::DOOR || i_grblState == GRBL_STATE::ALARM )
+		return; //GRBL is waiting on the user, not stuck
+
+	uint32_t age = millis() - ackEntries[i_ackHead].i_sentMillis;
+	bool checked = i_stallCheckMillis && millis() - i_stallCheckMillis < age; //checked on since this line was sent
+	if ( (checked ? millis() - i_stallCheckMillis : age) < stall_timeout )
+		return;
+
+	if ( !grblStatus.i_updateMillis || millis() - grblStatus.i_updateMillis >= STALL_PROBE_TIMEOUT ) //nothing recent to go by, ask
+	{
+		if ( !i_stallProbeMillis )
+		{
+			writeToGrbl(String('?'));
+			i_stallProbeMillis = millis();
+			i_statusProbes++;
+			return;
+		}
+
+		if ( millis() - i_stallProbeMillis < STALL_PROBE_TIMEOUT )
+			return;
+	}
+	else
+	{
+		bool moved = !checked || memcmp(f_stallMPos, grblStatus.f_mpos, sizeof(f_stallMPos));
+		if ( grblStatus.state != GRBL_STATE::RUN || moved ) //alive, and busy with a long move or a dwell, the wait starts over
+		{
+			i_stallCheckMillis = millis();
+			i_stallProbeMillis = 0;
+			memcpy(f_stallMPos, grblStatus.f_mpos, sizeof(f_stallMPos));
+			return;
+		}
+	}
+
+	b_ackStalled = true;
+	i_stallCount++;
+
+	if ( stall_actions & static_cast<uint8_t>(ACK_ACTION::NOTIFY) )
+		printMessageToHost(MSG_STALL + String(age) + MSG_MSEC + PSTR(", ") + i_ackCount + PSTR(" lines waiting]") + MSG_NLCR);
+
+	if ( stall_actions & static_cast<uint8_t>(ACK_ACTION::FEED_HOLD) )
+		writeToGrbl(String('!'));
+
+	if ( stall_actions & static_cast<uint8_t>(ACK_ACTION::FLASH) )
+	{
+		b_stallLightsEnabled = Lights.Enabled();
+		i_stallFlashMillis = millis();
+	}
+}
+
+//Called for every status report. Returns true if it is one we asked for, which the host must not get.
+bool statusProbeAnswered()
+{
+	if ( !i_statusProbes )
+		return false;
+
+	i_statusProbes--;
+	return true;
+}
+
+void printAckStats()
+{
+	uint32_t oldest = i_ackCount ? millis() - ackEntries[i_ackHead].i_sentMillis : 0;
+	printMessageToHost(PSTR("Lines waiting: ") + String(i_ackCount) + PSTR(" (oldest ") + oldest + PSTR(" msec), latency p50/p95/p99/max: ")
+					   + latencyPercentile(50) + '/' + latencyPercentile(95) + '/' + latencyPercentile(99) + '/' + i_latencyMax
+					   + MSG_MSEC + PSTR(", stalls: ") + i_stallCount + MSG_NLCR);
+}
@@ -0,0 +1,47 @@
+//Baselines for the /BENCH results (see benchmark.cpp). A result fails if it makes more allocations per operation than listed here,
+//or (where BENCH_TIME_TOLERANCE isn't 0) if it is more than BENCH_TIME_TOLERANCE percent slower.
+//Each benchmark prints its own line in this format, paste them in here when a change is meant to move the baseline.
+//An entry of 0 ns/op has not been recorded yet. Its result is reported as NO BASELINE, and the run doesn't pass until it is filled in.
+
+#ifndef BENCH_BASELINE_HEADER
+#define BENCH_BASELINE_HEADER
+
+struct BenchBaseline
+{
+	const char *name;
+	uint32_t i_nsPerOp;
+	float f_allocsPerOp;
+};
+
+#ifdef CNC_NATIVE
+//Measured with cnc_bench on an x86-64 Linux host (gcc 12, RelWithDebInfo). The times depend on the machine the tests run on, so
+//only the allocations are checked there, the times are kept for comparing runs on the same machine.
+#define BENCH_TIME_TOLERANCE 0 //percent, 0 = not checked
+
+const BenchBaseline benchBaseline[] = {
+	{ "splitString", 939, 7.00f },
+	{ "splitString_limited", 1079, 9.00f },
+	{ "removeFromStr", 461, 3.00f },
+	{ "strContains", 275, 1.00f },
+	{ "sendToHost", 956, 8.12f },
+	{ "handleCommandInteractions", 663, 7.01f },
+	{ "readSettings", 3345, 4.00f },
+	{ "writeSettings", 2725, 7.00f },
+};
+#else
+//Measured on an ESP32-DevKitC at 240 MHz. Still to be recorded: run /BENCH on an esp32dev_bench build and paste its lines in.
+#define BENCH_TIME_TOLERANCE 15 //percent
+
+const BenchBaseline benchBaseline[] = {
+	{ "splitString", 0, 0.00f },
+	{ "splitString_limited", 0, 0.00f },
+	{ "removeFromStr", 0, 0.00f },
+	{ "strContains", 0, 0.00f },
+	{ "sendToHost", 0, 0.00f },
+	{ "handleCommandInteractions", 0, 0.00f },
+	{ "readSettings", 0, 0.00f },
+	{ "writeSettings", 0, 0.00f },
+};
+#endif
+
+#endif
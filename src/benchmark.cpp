@@ -0,0 +1,268 @@
+/*
+This file contains the microbenchmarks for the string utilities, the command handlers and the settings file, run with /BENCH.
+Only built with CNC_BENCHMARK: in the esp32dev_bench environment, which also wraps malloc, calloc and realloc so that the allocations
+made by each benchmark can be counted, and in the host build, where cnc_bench (tools/bench.cpp) runs them under ctest and the
+allocations are counted by operator new.
+
+Time is measured with the CPU cycle counter. Everything the handlers would send to GRBL, the host or the relays is muted while the
+benchmarks run. Each result is compared against bench_baseline.h, and reported as failed if it is slower or allocates more. A result
+without a baseline can't be checked, and keeps the run from passing until one is recorded.
+
+The benchmarks leave the live state as they found it. The settings are read and written through a scratch file, never the
+configuration or the boot snapshot, and the settings, the machine state and its history are put back once they are done.
+*/
+#ifdef CNC_BENCHMARK
+
+#include "globaldefs.h"
+#include "bench_baseline.h"
+
+#define BENCH_ITERATIONS 2000 //operations for the in-memory benchmarks
+#define BENCH_FLASH_ITERATIONS 10 //operations for the benchmarks that touch SPIFFS
+
+const String &file_Bench PROGMEM = PSTR("/bench.cfg"); //scratch settings file
+
+//A short piece of a real CAM export (2D adaptive clearing and a contour), used for the command handler benchmark.
+const char *const benchCorpus[] PROGMEM = {
+	"%",
+	"(1001)",
+	"(T1 D=6. CR=0. - ZMIN=-3. - flat end mill)",
+	"G90 G94",
+	"G17",
+	"G21",
+	"G28 G91 Z0.",
+	"G90",
+	"T1 M6",
+	"S18000 M3",
+	"G54",
+	"G0 X42.113 Y17.5",
+	"Z15.",
+	"Z5.",
+	"G1 Z1. F333.3",
+	"G3 X41.928 Y18.031 Z0.914 I-1.188 J-0.118",
+	"G1 X41.871 Y18.189 Z0.861 F1000.",
+	"X41.768 Y18.468 Z0.767",
+	"X41.693 Y18.671 Z0.698",
+	"G2 X41.012 Y19.904 I1.93 J1.87",
+	"G1 X40.5 Y20.25",
+	"X39.877 Y20.618",
+	"X39.204 Y20.944",
+	"G3 X38.553 Y21.187 I-1.12 J-2.016",
+	"G1 X37.901 Y21.354",
+	"X37.25 Y21.462",
+	"X36.598 Y21.51",
+	"G0 Z15.",
+	"G1 X10. Y10. F1000. (contour, pass 1)",
+	"Y40.",
+	"X50.",
+	"Y10.",
+	"X10.",
+	"M5",
+	"G28 G91 Z0.",
+	"G90",
+	"M30",
+	"%",
+};
+
+//Reply lines from GRBL, in the proportions they arrive while a job runs.
+const char *const benchReplies[] PROGMEM = {
+	"ok\r\n",
+	"ok\r\n",
+	"ok\r\n",
+	"<Run|MPos:12.345,-6.789,-1.000|Bf:12,98|FS:1000,18000|Ov:100,100,100>\r\n",
+	"ok\r\n",
+	"error:20\r\n",
+	"[MSG:Pgm End]\r\n",
+	"<Idle|WPos:0.000,0.000,0.000|FS:0,0|WCO:10.000,20.000,-5.000>\r\n",
+};
+
+const String &benchLine PROGMEM = PSTR("G1 X41.871 Y18.189 Z0.861 F1000. (adaptive, pass 3)\r\n");
+
+//The corpus and replies as Strings, built before the timing starts so that the conversion isn't counted.
+vector<String> benchCorpusLines,
+			   benchReplyLines;
+
+//Allocation counting, see the __wrap_ functions (or operator new) below.
+bool b_benchCounting;
+TaskHandle_t benchTask;
+uint32_t i_benchAllocs,
+		 i_benchBytes;
+uint8_t i_benchUnchecked; //results that had no baseline to be compared against
+
+//Only the task running the benchmarks is counted, the Bluetooth and WiFi stacks allocate in the background.
+void countAllocation( size_t size )
+{
+	if ( b_benchCounting && xTaskGetCurrentTaskHandle() == benchTask )
+	{
+		i_benchAllocs++;
+		i_benchBytes += size;
+	}
+}
+
+#ifdef CNC_NATIVE
+//On the host, String is built on std::string, which allocates through operator new.
+void *operator new( size_t size )
+{
+	countAllocation(size);
+	void *ptr = malloc(size ? size : 1);
+	if ( !ptr )
+		throw bad_alloc();
+	return ptr;
+}
+
+void operator delete( void *ptr ) noexcept { free(ptr); }
+void operator delete( void *ptr, size_t ) noexcept { free(ptr); }
+#else
+extern "C"
+{
+	void *__real_malloc( size_t size );
+	void *__real_calloc( size_t count, size_t size );
+	void *__real_realloc( void *ptr, size_t size );
+
+	void *__wrap_malloc( size_t size )
+	{
+		countAllocation(size);
+		return __real_malloc(size);
+	}
+
+	void *__wrap_calloc( size_t count, size_t size )
+	{
+		countAllocation(count * size);
+		return __real_calloc(count, size);
+	}
+
+	void *__wrap_realloc( void *ptr, size_t size )
+	{
+		countAllocation(size);
+		return __real_realloc(ptr, size);
+	}
+}
+#endif
+
+//Runs body for the given number of operations and reports the cost per operation against the baseline. Returns false on a regression.
+bool runBenchmark( const char *name, uint32_t ops, void (*body)(uint32_t) )
+{
+	body(0); //warm up, so that one-time allocations (settings map, caches) aren't counted
+
+	i_benchAllocs = 0;
+	i_benchBytes = 0;
+	b_benchCounting = true;
+	uint32_t start = ESP.getCycleCount();
+
+	for ( uint32_t x = 0; x < ops; x++ )
+		body(x);
+
+	uint32_t cycles = ESP.getCycleCount() - start;
+	b_benchCounting = false;
+
+	float nsPerOp = cycles * 1000.0f / ESP.getCpuFreqMHz() / ops,
+		  allocsPerOp = static_cast<float>(i_benchAllocs) / ops;
+	uint32_t bytesPerOp = i_benchBytes / ops;
+
+	String result = String(name) + PSTR(": ") + String(nsPerOp, 0) + PSTR(" ns/op, ") + String(allocsPerOp, 2) + PSTR(" allocs/op, ")
+					+ bytesPerOp + PSTR(" bytes/op");
+
+	bool passed = true,
+		 checked = false;
+	for ( uint8_t x = 0; x < sizeof(benchBaseline) / sizeof(benchBaseline[0]); x++ )
+	{
+		const BenchBaseline &baseline = benchBaseline[x];
+		if ( strcmp(baseline.name, name) || !baseline.i_nsPerOp ) //nothing recorded yet
+			continue;
+
+		checked = true;
+		passed = (!BENCH_TIME_TOLERANCE || nsPerOp <= baseline.i_nsPerOp * (100 + BENCH_TIME_TOLERANCE) / 100.0f) && String(allocsPerOp, 2).toFloat() <= baseline.f_allocsPerOp; //as printed in the baseline line
+		result += PSTR(" (baseline ") + String(baseline.i_nsPerOp) + PSTR(" ns/op, ") + String(baseline.f_allocsPerOp, 2) + PSTR(" allocs/op) ")
+				  + (passed ? PSTR("ok") : PSTR("FAIL"));
+	}
+
+	if ( !checked )
+	{
+		i_benchUnchecked++;
+		result += PSTR(" (NO BASELINE, add the line below to bench_baseline.h)");
+	}
+
+	b_outputMuted = false; //the report itself has to get out
+	printMessageToHost(result + MSG_NLCR);
+	printMessageToHost(PSTR("    { \"") + String(name) + PSTR("\", ") + static_cast<uint32_t>(nsPerOp + 0.5f) + PSTR(", ") + String(allocsPerOp, 2) + PSTR("f },") + MSG_NLCR);
+	b_outputMuted = true;
+	return passed;
+}
+
+//Runs every benchmark. GRBL must be idle, the state the handlers change is put back afterwards. Returns true if they all passed.
+bool runBenchmarks()
+{
+	if ( b_framedMode || i_grblState != GRBL_STATE::IDLE )
+	{
+		printMessageToHost(PSTR("Benchmarks need GRBL to be idle, in plain text mode.") + MSG_NLCR);
+		return false;
+	}
+
+	printMessageToHost(PSTR("Running benchmarks at ") + String(ESP.getCpuFreqMHz()) + PSTR(" MHz. Baseline lines follow each result.") + MSG_NLCR);
+
+	benchTask = xTaskGetCurrentTaskHandle();
+	for ( const char *line : benchCorpus )
+		benchCorpusLines.emplace_back(String(line) + CHAR_NEWLINE);
+	for ( const char *line : benchReplies )
+		benchReplyLines.emplace_back(line);
+
+	//What the benchmarks change, put back at the end. The made up status reports go into the machine state and its history.
+	uint8_t relays = relayStates();
+	String liveSettings = settingsText();
+	shared_ptr<TelemetrySnapshot> liveTelemetry = saveTelemetry();
+	uint8_t failed = 0;
+	i_benchUnchecked = 0;
+	b_outputMuted = true;
+
+	failed += !runBenchmark("splitString", BENCH_ITERATIONS, []( uint32_t ){ splitString(benchLine, ' '); });
+	failed += !runBenchmark("splitString_limited", BENCH_ITERATIONS, []( uint32_t ){ splitString(benchLine, ' ', true, '(', ')'); });
+	failed += !runBenchmark("removeFromStr", BENCH_ITERATIONS, []( uint32_t ){ removeFromStr(benchLine, {CHAR_NEWLINE, CHAR_CARRIAGE}); });
+	failed += !runBenchmark("strContains", BENCH_ITERATIONS, []( uint32_t ){ strContains(benchLine, {';', '%'}); });
+
+	failed += !runBenchmark("sendToHost", BENCH_ITERATIONS, []( uint32_t x )
+	{
+		sendToHost(benchReplyLines[x % benchReplyLines.size()]);
+	});
+
+	failed += !runBenchmark("handleCommandInteractions", BENCH_ITERATIONS, []( uint32_t x )
+	{
+		handleCommandInteractions(benchCorpusLines[x % benchCorpusLines.size()]);
+	});
+
+	if ( b_FSOpen && writeSettingsFile(file_Bench) ) //the same reading and applying that the boot does, and the writing that /S does
+	{
+		failed += !runBenchmark("readSettings", BENCH_FLASH_ITERATIONS, []( uint32_t )
+		{
+			String text;
+			readSettingsFile(file_Bench, text);
+			applySettings(text);
+		});
+		failed += !runBenchmark("writeSettings", BENCH_FLASH_ITERATIONS, []( uint32_t ){ writeSettingsFile(file_Bench); });
+		SPIFFS.remove(file_Bench);
+	}
+	else
+	{
+		i_benchUnchecked += 2;
+		b_outputMuted = false;
+		printMessageToHost(PSTR("SPIFFS is not available, the settings file benchmarks were skipped.") + MSG_NLCR);
+	}
+
+	setRelayStates(relays); //never switched, only their recorded states need to be put back
+	applySettings(liveSettings);
+	restoreTelemetry(*liveTelemetry);
+	i_grblState = GRBL_STATE::IDLE;
+	resetSession(); //the replies completed lines that were never sent
+	b_outputMuted = false;
+	benchCorpusLines.clear();
+	benchReplyLines.clear();
+
+	if ( failed )
+		printMessageToHost(PSTR("Benchmarks FAILED: ") + String(failed) + PSTR(" regressed") + MSG_NLCR);
+	else if ( i_benchUnchecked )
+		printMessageToHost(PSTR("Benchmarks NOT CHECKED: ") + String(i_benchUnchecked) + PSTR(" have no baseline") + MSG_NLCR);
+	else
+		printMessageToHost(PSTR("Benchmarks passed") + MSG_NLCR);
+
+	return !failed && !i_benchUnchecked;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/*
+This file contains the start up of the ESP-32. Only the two serial ports are opened in setup(), so that lines from the host reach GRBL
+within a few msec of a reset (after a brownout the host usually reconnects long before the rest would be ready). Bluetooth, SPIFFS and
+reading the settings file are done by a task on the other core, and their results are picked up by the main loop once it is done.
+
+Until the settings file has been read, the settings and the lights come from a snapshot kept in RTC memory, which survives a reset
+(but not a power cycle). A setting the host changes in the meantime is kept, the file doesn't overwrite it once it has been read. The vacuum is never switched back on by itself, and the cooler follows the spindle as always.
+The boot times are reported in a [MSG:...] line once everything is up, again after every GRBL welcome message, and on request with /BOOT.
+The time the first line from the host went on to GRBL is only part of it once that has happened (status polls and other realtime
+commands don't count, a host sends those long before it streams a line).
+*/
+#include "globaldefs.h"
+
+#define BOOT_SNAPSHOT_MAGIC 0x43424F54 //"CBOT"
+#define BOOT_SNAPSHOT_SIZE 512 //bytes of settings text, a longer text is not kept
+#define BOOT_TASK_STACK 8192
+#define BOOT_TASK_CORE 0 //loop() runs on core 1
+#define BOOT_RESTORED_RELAYS 0x02 //lights only, see relayStates()
+
+//Kept in RTC memory, which is left alone by a reset. Only trusted if the magic and CRC match.
+struct BootSnapshot
+{
+	uint32_t i_magic;
+	uint8_t i_relays; //relayStates()
+	uint16_t i_length;
+	char settings[BOOT_SNAPSHOT_SIZE + 1]; //settingsText(), always terminated
+	uint32_t i_crc;
+};
+
+RTC_NOINIT_ATTR BootSnapshot bootSnapshot;
+
+//Set by the background task, read by the main loop.
+volatile bool b_bluetoothReady,
+			  b_bootTaskDone;
+bool b_bootSPIFFSOpen,
+	 b_bootSettingsRead,
+	 b_bootComplete,
+	 b_bootFromSnapshot;
+String s_bootSettings;
+vector<String> bootRuntimeSettings; //changed by the host before the settings file was read
+
+uint32_t i_bootLiveMillis, //passthrough running
+		 i_bootBluetoothMillis,
+		 i_bootStorageMillis,
+		 i_firstForwardMillis; //first line from the host sent on to GRBL
+
+uint32_t bootSnapshotCRC()
+{
+	return crc32Update(0xFFFFFFFF, reinterpret_cast<const uint8_t *>(&bootSnapshot), offsetof(BootSnapshot, i_crc));
+}
+
+bool bootSnapshotValid()
+{
+	return bootSnapshot.i_magic == BOOT_SNAPSHOT_MAGIC && bootSnapshot.i_length <= BOOT_SNAPSHOT_SIZE && bootSnapshot.i_crc == bootSnapshotCRC();
+}
+
+//Keeps the current settings and relay states in RTC memory, for the next reset.
+void saveBootSnapshot()
+{
+	String text = settingsText();
+	if ( text.length() > BOOT_SNAPSHOT_SIZE )
+		text.clear(); //the relay states are still worth keeping
+
+	bootSnapshot.i_magic = BOOT_SNAPSHOT_MAGIC;
+	bootSnapshot.i_relays = relayStates();
+	bootSnapshot.i_length = text.length();
+	memset(bootSnapshot.settings, 0, sizeof(bootSnapshot.settings)); //so that the CRC doesn't cover old text
+	memcpy(bootSnapshot.settings, text.c_str(), text.length());
+	bootSnapshot.i_crc = bootSnapshotCRC();
+}
+
+//Puts back the settings and lights from before the reset, if RTC memory still holds them. Called from setup().
+void restoreBootSnapshot()
+{
+	if ( !bootSnapshotValid() )
+		return;
+
+	applySettings(String(bootSnapshot.settings));
+	setRelayStates(bootSnapshot.i_relays & BOOT_RESTORED_RELAYS);
+	b_bootFromSnapshot = true;
+}
+
+//Runs on the other core. Only touches what nothing else uses until b_bootTaskDone is set.
+void bootTask( void * )
+{
+	BtSerial.begin("CNC");	//Initialize the bluetooth serial interface
+	BtSerial.setPin("1234"); //password (pin) for connecting
+	i_bootBluetoothMillis = millis();
+	b_bluetoothReady = true;
+
+	b_bootSPIFFSOpen = SPIFFS.begin(true); //Format on fail = true.
+	if ( b_bootSPIFFSOpen )
+		b_bootSettingsRead = readSettingsFile(file_Configuration, s_bootSettings);
+	i_bootStorageMillis = millis();
+
+	b_bootTaskDone = true;
+	vTaskDelete(nullptr);
+}
+
+void startBootTask()
+{
+	i_bootLiveMillis = millis();
+	xTaskCreatePinnedToCore(bootTask, "boot", BOOT_TASK_STACK, nullptr, 1, nullptr, BOOT_TASK_CORE);
+}
+
+void printBootBanner()
+{
+	printMessageToHost(PSTR("[MSG:Boot: passthrough ") + String(i_bootLiveMillis) + PSTR(" msec, bluetooth ") + i_bootBluetoothMillis
+					   + PSTR(" msec, settings ") + i_bootStorageMillis + PSTR(" msec") + (b_bootFromSnapshot ? PSTR(" (RTC snapshot until then)") : PSTR(""))
+					   + (i_firstForwardMillis ? PSTR(", first forward ") + String(i_firstForwardMillis) + PSTR(" msec") : String())
+					   + ']' + MSG_NLCR);
+}
+
+//Called whenever the host changes a setting. Until the settings file has been read, the change is remembered so that it is kept.
+void noteRuntimeSetting( const String &id )
+{
+	if ( !b_bootComplete )
+		bootRuntimeSettings.push_back(id);
+}
+
+//Called once per cycle. Takes over what the background task has brought up, and keeps the relay states in the snapshot current.
+void serviceBoot()
+{
+	if ( b_bootComplete )
+	{
+		if ( bootSnapshot.i_relays != relayStates() )
+			saveBootSnapshot();
+		return;
+	}
+
+	if ( !b_bootTaskDone )
+		return;
+
+	b_bootComplete = true;
+	b_FSOpen = b_bootSPIFFSOpen;
+
+	if ( !b_FSOpen )
+		printMessageToHost(PSTR("Failed to initialize SPIFFS storage system.") + MSG_NLCR);
+	else if ( !b_bootSettingsRead )
+		printMessageToHost(err_Config + MSG_NLCR);
+	else
+	{
+		applySettings(s_bootSettings, bootRuntimeSettings);
+		printMessageToHost(succ_Config_loaded + MSG_NLCR);
+	}
+
+	s_bootSettings = String(); //free it
+	bootRuntimeSettings = vector<String>();
+	saveBootSnapshot();
+	printBootBanner();
+}
@@ -0,0 +1,352 @@
+/*
+This file contains the session capture, for reproducing problems that depend on the timing between the host, GRBL and loop().
+While a capture is running, every chunk read from the host or from GRBL is written to SPIFFS along with its arrival time, and everything
+the ESP-32 sends out (to GRBL, to the host and to the relays) is written along with them.
+
+Started with /CAP=1, stopped with /CAP=0 (or once the file reaches CAPMAX kB). Starting a capture forgets the progress of a running job
+and the line latencies, so it is best started before the job. /CAPDUMP copies the file to the host as [CAP:...] lines of base64, one
+per cycle, ending with [CAP:END bytes crc32]. Files that the session reads from SPIFFS (a stored job, the pre-flight cache) are not
+part of the capture.
+
+Captures are replayed on a Linux host, never on the ESP-32: cnc_replay (tools/replay.cpp, see replay.cpp) takes the file or the /CAPDUMP
+log, feeds the chunks back through loop() on a virtual clock, and compares what the firmware sends out with what was captured.
+test/captures holds the sessions that every build is checked against.
+
+The file (/capture.bin) holds a series of records:
+    type (1 byte) | time since the previous record (msec, varint) | data length (varint) | data
+    'S' - state at the start: start time (4 bytes), relays (1 byte, bit 0 vacuum, 1 lights, 2 cooler), GRBL state (1 byte),
+          followed by the ESP-32 settings (KEY=value) and the GRBL settings mirror ($n=value), one per line.
+    'H' - bytes read from the host.
+    'G' - bytes read from GRBL.
+    'g' - bytes sent to GRBL.
+    'h' - bytes sent to the host.
+    'r' - relay actions, the name of the relay followed by '+' or '-'.
+    'E' - end of the capture: byte count (4 bytes each) of the GRBL, host and relay output, in that order.
+Numbers are LSB first. Varints hold 7 bits per byte, the top bit is set on all but the last byte.
+*/
+#include "globaldefs.h"
+
+#define CAPTURE_BUFFER_SIZE 512 //bytes held in RAM before they are written to flash
+#define CAPTURE_DUMP_LINE 48 //bytes of the file per [CAP:] line, 64 characters of base64
+
+const String &file_Capture PROGMEM = PSTR("/capture.bin");
+
+const String &MSG_CAPTURE_BUSY PROGMEM = PSTR("A capture is already running.");
+
+Peripheral *const sessionRelays[] = { &Vacuum, &Lights, &Cooler }; //bit order of the relay states
+const CAPTURE_RECORD outputRecords[CAPTURE_OUTPUTS] = { CAPTURE_RECORD::GRBL_OUT, CAPTURE_RECORD::HOST_OUT, CAPTURE_RECORD::RELAYS_OUT };
+
+bool b_captureActive,
+     b_replayActive,
+     b_outputMuted,
+     b_replayStopped; //the replay has reached the point where the capture was stopped
+
+uint32_t capture_limit,
+         i_captureBytes, //written so far, including what is still in the buffer
+         i_captureRecords,
+         i_captureLastMillis, //time of the last record
+         i_sessionOutputBytes[CAPTURE_OUTPUTS], //sent so far, for the end record
+         i_dumpCrc;
+
+File captureFile,
+     dumpFile;
+uint8_t captureBuffer[CAPTURE_BUFFER_SIZE];
+uint16_t i_captureBufferLength;
+
+//CRC-32 (reflected polynomial 0xEDB88320), one nibble at a time to keep the table small. The final inversion is left to the caller.
+uint32_t crc32Update( uint32_t crc, const uint8_t *data, size_t length )
+{
+    static const uint32_t table[16] = { 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+                                        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+    for ( size_t x = 0; x < length; x++ )
+    {
+        crc ^= data[x];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return crc;
+}
+
+//True while the outputs should be recorded.
+bool sessionRecording()
+{
+    return b_captureActive || (b_replayActive && !b_replayStopped);
+}
+
+void recordSessionOutput( SESSION_OUTPUT output, const uint8_t *data, size_t length )
+{
+    if ( !sessionRecording() )
+        return;
+
+    uint8_t index = static_cast<uint8_t>(output);
+#ifdef CNC_NATIVE
+    if ( b_replayActive )
+    {
+        replayOutput(index, data, length);
+        return;
+    }
+#endif
+
+    for ( size_t x = 0; x < length; x += CAPTURE_MAX_RECORD )
+    {
+        uint16_t piece = min(length - x, static_cast<size_t>(CAPTURE_MAX_RECORD));
+        captureChunk(outputRecords[index], data + x, piece);
+        if ( !b_captureActive ) //the file is full, this is where the capture ends
+            return;
+        i_sessionOutputBytes[index] += piece;
+    }
+}
+
+void recordPeripheralAction( const String &name, bool enabled )
+{
+    if ( !sessionRecording() )
+        return;
+
+    String action = name + (enabled ? '+' : '-');
+    recordSessionOutput(SESSION_OUTPUT::RELAYS, reinterpret_cast<const uint8_t *>(action.c_str()), action.length());
+}
+
+void putUint32( uint8_t *out, uint32_t value )
+{
+    for ( uint8_t x = 0; x < 4; x++ )
+        out[x] = static_cast<uint8_t>(value >> (x * 8));
+}
+
+uint32_t getUint32( const uint8_t *in )
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+void flushCaptureBuffer()
+{
+    if ( i_captureBufferLength )
+        captureFile.write(captureBuffer, i_captureBufferLength);
+    i_captureBufferLength = 0;
+}
+
+void captureWrite( const uint8_t *data, size_t length )
+{
+    for ( size_t x = 0; x < length; x++ )
+    {
+        captureBuffer[i_captureBufferLength++] = data[x];
+        if ( i_captureBufferLength == CAPTURE_BUFFER_SIZE )
+            flushCaptureBuffer();
+    }
+    i_captureBytes += length;
+}
+
+void captureVarint( uint32_t value )
+{
+    uint8_t out[5], length = 0;
+    do
+    {
+        out[length] = value & 0x7F;
+        value >>= 7;
+        if ( value )
+            out[length] |= 0x80;
+        length++;
+    } while ( value );
+
+    captureWrite(out, length);
+}
+
+//Starts a record, the data follows with captureWrite().
+void captureRecordHeader( CAPTURE_RECORD type, uint32_t length )
+{
+    uint32_t now = millis();
+    uint8_t c = static_cast<uint8_t>(type);
+    captureWrite(&c, 1);
+    captureVarint(now - i_captureLastMillis);
+    captureVarint(length);
+    i_captureLastMillis = now;
+    i_captureRecords++;
+}
+
+//A local command that sets a secret (/WPASS=...) is captured with its value masked, as the settings snapshot has it.
+//Anything after the value is masked with it. Returns false for any other chunk.
+bool captureMaskedSecret( const uint8_t *data, uint16_t length )
+{
+    const uint8_t *equals = static_cast<const uint8_t *>(memchr(data, CHAR_EQUALS, length));
+    if ( data[0] != '/' || !equals )
+        return false;
+
+    String id;
+    for ( const uint8_t *c = data + 1; c < equals; c++ )
+        id += static_cast<char>(toupper(*c));
+
+    settings_itr = settingsMap.find(id);
+    if ( settings_itr == settingsMap.end() || !settings_itr->second->isSecret() )
+        return false;
+
+    String masked = String('/') + id + CHAR_EQUALS + MSG_SECRET_MASK + CHAR_NEWLINE;
+    captureRecordHeader(CAPTURE_RECORD::HOST, masked.length());
+    captureWrite(reinterpret_cast<const uint8_t *>(masked.c_str()), masked.length());
+    return true;
+}
+
+//Called with every chunk that is read from the host or from GRBL, before it is handled.
+void captureChunk( CAPTURE_RECORD type, const uint8_t *data, uint16_t length )
+{
+    if ( !b_captureActive || !length )
+        return;
+
+    if ( length > CAPTURE_MAX_RECORD || i_captureBytes + length > capture_limit * 1024 )
+    {
+        endCapture();
+        return;
+    }
+
+    if ( type == CAPTURE_RECORD::HOST && captureMaskedSecret(data, length) )
+        return;
+
+    captureRecordHeader(type, length);
+    captureWrite(data, length);
+}
+
+uint8_t relayStates()
+{
+    uint8_t states = 0;
+    for ( uint8_t x = 0; x < sizeof(sessionRelays) / sizeof(sessionRelays[0]); x++ )
+    {
+        if ( sessionRelays[x]->Enabled() )
+            states |= 1 << x;
+    }
+    return states;
+}
+
+void setRelayStates( uint8_t states )
+{
+    for ( uint8_t x = 0; x < sizeof(sessionRelays) / sizeof(sessionRelays[0]); x++ )
+    {
+        if ( states & (1 << x) )
+            sessionRelays[x]->Enable();
+        else
+            sessionRelays[x]->Disable();
+    }
+}
+
+//Returns the ESP-32 settings (secrets masked, a capture is meant to be shared) and the GRBL settings mirror, one per line.
+String settingsSnapshot()
+{
+    return settingsText(true) + grblSettingsSnapshot();
+}
+
+void restoreSettingsSnapshot( const String &snapshot )
+{
+    applySettings(snapshot); //the "$n=value" lines are not ESP-32 settings, and are skipped
+    restoreGrblSettings(snapshot);
+}
+
+void beginCapture()
+{
+    if ( b_captureActive || b_replayActive || dumpFile )
+    {
+        printMessageToHost(MSG_CAPTURE_BUSY + MSG_NLCR);
+        return;
+    }
+
+    if ( !b_FSOpen || b_framedMode )
+    {
+        printMessageToHost(PSTR("A capture needs SPIFFS, and must be started in plain text mode.") + MSG_NLCR);
+        return;
+    }
+
+    captureFile = SPIFFS.open(file_Capture, FILE_WRITE);
+    if ( !captureFile )
+    {
+        printMessageToHost(PSTR("Failed to create ") + file_Capture + MSG_NLCR);
+        return;
+    }
+
+    printMessageToHost(PSTR("Capture started.") + MSG_NLCR); //before the recording starts, a replay never prints this
+
+    resetSession();
+    i_captureBufferLength = 0;
+    i_captureBytes = 0;
+    i_captureRecords = 0;
+    i_captureLastMillis = millis();
+    b_captureActive = true;
+
+    String snapshot = settingsSnapshot();
+    uint8_t header[CAPTURE_SNAPSHOT_HEADER];
+    putUint32(header, i_captureLastMillis);
+    header[4] = relayStates();
+    header[5] = static_cast<uint8_t>(i_grblState);
+
+    captureRecordHeader(CAPTURE_RECORD::SNAPSHOT, sizeof(header) + snapshot.length());
+    captureWrite(header, sizeof(header));
+    captureWrite(reinterpret_cast<const uint8_t *>(snapshot.c_str()), snapshot.length());
+
+    for ( uint8_t x = 0; x < CAPTURE_OUTPUTS; x++ )
+        i_sessionOutputBytes[x] = 0;
+}
+
+void endCapture()
+{
+    if ( b_replayActive ) //this is where the capture ended, nothing after this counts
+    {
+        b_replayStopped = true;
+        return;
+    }
+
+    if ( !b_captureActive )
+        return;
+
+    b_captureActive = false;
+
+    uint8_t trailer[CAPTURE_OUTPUTS * 4];
+    for ( uint8_t x = 0; x < CAPTURE_OUTPUTS; x++ )
+        putUint32(trailer + x * 4, i_sessionOutputBytes[x]);
+
+    captureRecordHeader(CAPTURE_RECORD::END, sizeof(trailer));
+    captureWrite(trailer, sizeof(trailer));
+    flushCaptureBuffer();
+    captureFile.close();
+
+    printMessageToHost(PSTR("Capture stopped: ") + String(i_captureRecords) + PSTR(" records, ") + i_captureBytes + PSTR(" bytes") + MSG_NLCR);
+}
+
+void printCaptureStatus()
+{
+    if ( b_captureActive )
+        printMessageToHost(PSTR("Capturing: ") + String(i_captureRecords) + PSTR(" records, ") + i_captureBytes + PSTR(" of ") + capture_limit * 1024 + PSTR(" bytes") + MSG_NLCR);
+    else
+        printMessageToHost(PSTR("No capture running.") + MSG_NLCR);
+}
+
+//Starts copying the capture to the host, see serviceCaptureDump().
+void dumpCapture()
+{
+    if ( b_captureActive || dumpFile )
+    {
+        printMessageToHost(MSG_CAPTURE_BUSY + MSG_NLCR);
+        return;
+    }
+
+    dumpFile = b_FSOpen ? SPIFFS.open(file_Capture, FILE_READ) : File();
+    if ( !dumpFile )
+    {
+        printMessageToHost(PSTR("No capture found.") + MSG_NLCR);
+        return;
+    }
+    i_dumpCrc = 0xFFFFFFFF;
+}
+
+//Called once per cycle, sends one line of the capture that is being dumped so that loop() is never held up for long.
+void serviceCaptureDump()
+{
+    if ( !dumpFile )
+        return;
+
+    uint8_t data[CAPTURE_DUMP_LINE];
+    size_t length = dumpFile.read(data, sizeof(data));
+    if ( length )
+    {
+        i_dumpCrc = crc32Update(i_dumpCrc, data, length);
+        printMessageToHost(PSTR("[CAP:") + base64Encode(data, length) + ']' + MSG_NLCR);
+        return;
+    }
+
+    printMessageToHost(PSTR("[CAP:END ") + String(dumpFile.size()) + ' ' + String(~i_dumpCrc, HEX) + ']' + MSG_NLCR);
+    dumpFile.close();
+}
@@ -9,7 +9,8 @@ const String &file_Configuration PROGMEM = PSTR("/config.cfg");
 bool b_vacuumOnRouter, //turn on the vacuum when the router is enabled?
 	 b_lightsOnRouter, //turn on the lights when the router is enabled?
 	 b_simulationMode,
-     b_flashOnAlarm;
+     b_flashOnAlarm,
+     b_progressInStatus; //append job progress to the status reports sent to the host?
 //
 
 bool b_FSOpen;
@@ -138,4 +139,10 @@ bool strContains( const String &str, const vector<char> &c )
 	return false;
 }
 
-bool strContains( const String &str, const char c ){ return strContains(str, vector<char>{c}); }
\ No newline at end of file
+bool strContains( const String &str, const char c ){ return strContains(str, vector<char>{c}); }
+
+//GRBL picks these out of the serial stream as they arrive, they are never part of a line (and never answered with "ok").
+bool isGrblRealtime( uint8_t c )
+{
+	return c == '?' || c == '!' || c == '~' || c == 0x18 || c >= 0x80;
+}
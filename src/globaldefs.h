@@ -30,19 +30,66 @@ extern const String &CMD_VACUUM_ROUTER PROGMEM,
 			 		&CMD_ALARM_TON PROGMEM,
 					&CMD_COOLER_TOFF PROGMEM;   
 
+extern const String &CMD_ACCELERATION PROGMEM,
+					&CMD_PROGRESS_STATUS PROGMEM,
+					&CMD_STALL_TIMEOUT PROGMEM,
+					&CMD_STALL_ACTIONS PROGMEM,
+					&CMD_LATENCY_SLO PROGMEM,
+					&CMD_CAPTURE_LIMIT PROGMEM,
+					&CMD_TELEMETRY PROGMEM,
+					&CMD_TELEMETRY_INTERVAL PROGMEM,
+					&CMD_WIFI_SSID PROGMEM,
+					&CMD_WIFI_PASSWORD PROGMEM,
+					&CMD_WIFI_WITH_BLUETOOTH PROGMEM,
+					&CMD_OPTIMIZER PROGMEM,
+					&CMD_OPTIMIZER_TOLERANCE PROGMEM,
+					&CMD_SOFT_LIMIT_X PROGMEM,
+					&CMD_SOFT_LIMIT_Y PROGMEM,
+					&CMD_SOFT_LIMIT_Z PROGMEM;
+
 extern uint32_t alarm_flash_time_on,
 		 	    alarm_flash_time_off,
-				cooler_off_delay;
+				cooler_off_delay,
+				default_acceleration, //used by the job progress estimate until GRBL's own settings are known (mm/sec^2)
+				stall_timeout, //msec without a reply from GRBL before the stall actions are taken (0 = disabled)
+				latency_slo; //msec, the host is told when the rolling p95 line latency goes above this (0 = disabled)
+
+extern uint8_t stall_actions; //ACK_ACTION bits
+
+//Actions that can be taken when GRBL stops replying to the lines we send it.
+enum class ACK_ACTION : uint8_t
+{
+	NOTIFY = 1, //send a [MSG:...] to the host
+	FLASH = 2, //flash the lights
+	FEED_HOLD = 4, //ask GRBL to hold
+};
 
 //Settings variables
 extern bool b_vacuumOnRouter, //turn on the vacuum when the router is enabled?
 	        b_lightsOnRouter, //turn on the lights when the router is enabled?
 			b_simulationMode, //used for differentiating between what is a simulation and what isnt.
-			b_flashOnAlarm; //flash the light system when an alarm is present?
+			b_flashOnAlarm, //flash the light system when an alarm is present?
+			b_progressInStatus; //append job progress to the status reports sent to the host?
 //
 
 extern bool b_FSOpen;
 
+extern HardwareSerial &GRBL;
+
+enum class GRBL_STATE : uint8_t 
+{
+	ALARM = 'A',
+	IDLE = 'I',
+	RUN = 'R',
+	JOG = 'J',
+	DOOR = 'D',
+	CHECK = 'C',
+	HOME_HOLD = 'H', //can this also be shared with HOLD?
+	SLEEP = 'S',
+};
+
+extern GRBL_STATE i_grblState;
+
 //Function prototypes here
 
 //main stuff here
@@ -50,16 +97,228 @@ extern bool b_FSOpen;
 void sendToHost(const String &);
 void printMessageToHost(const String &);
 String readFromHost(); 
+void readFromGrbl();
 String handleCommandInteractions( const String & );
+String handleLineInteractions( const String & );
 void handleLocalCommand(const String &);
+void forwardToGrbl( const String &, uint8_t merged = 0 );
+void sendInternalToGrbl(const String &);
+void processHostCommand(const String &);
+void sendOkToHost();
+Stream &hostStream();
+void writeToHost( const uint8_t *, size_t );
+void writeToGrbl( const String & );
+void handleGrblData( const uint8_t *, uint16_t );
+void serviceMachineState();
+void resetSession();
+bool bluetoothHostConnected();
+extern bool b_hostLinesAhead; //lines of the host chunk being handled that are still to be forwarded, ahead of the current one
 //
 
 //Storage related stuff here
+extern const String &err_Config PROGMEM,
+					&succ_Config_loaded PROGMEM,
+					&MSG_SECRET_MASK PROGMEM;
+
 void generateSettingsMap();
-bool loadSettings();
+String settingsText( bool masked = false );
+void applySettings( const String &, const vector<String> &keep = {} );
+bool readSettingsFile( const String &path, String &text );
+bool writeSettingsFile( const String &path );
 bool saveSettings();
 //
 
+//Boot related stuff here
+extern BluetoothSerial BtSerial;
+extern volatile bool b_bluetoothReady; //set by the background initialization once BtSerial can be used
+extern bool b_bootComplete;
+extern uint32_t i_firstForwardMillis;
+
+void startBootTask();
+void restoreBootSnapshot();
+void saveBootSnapshot();
+void serviceBoot();
+void noteRuntimeSetting( const String &id );
+void printBootBanner();
+//
+
+//GRBL settings mirror related stuff here
+enum class GRBL_SETTING : uint8_t
+{
+	JUNCTION_DEVIATION = 11, //mm
+	ARC_TOLERANCE = 12, //mm
+	REPORT_INCHES = 13, //bool
+	SOFT_LIMITS = 20, //bool
+	HARD_LIMITS = 21, //bool
+	HOMING_CYCLE = 22, //bool
+	STEPS_X = 100, //steps/mm, Y and Z follow at +1 and +2
+	MAX_RATE_X = 110, //mm/min
+	ACCEL_X = 120, //mm/sec^2
+	MAX_TRAVEL_X = 130, //mm
+};
+
+extern bool b_grblSettingsValid; //true once the mirror holds a complete copy of GRBL's $$ listing.
+extern uint16_t i_grblSettingsRevision; //incremented whenever the mirror changes, so that users can refresh their copies.
+
+void requestGrblSettings();
+void serviceGrblSettings();
+bool trackSettingWrite( const String & );
+void clearSettingWrites();
+bool strayGrblOk( const String & );
+bool parseGrblSettingsReply( const String &, bool internal, bool settingWrite );
+bool grblSettingsAnswerable();
+bool handleGrblSettingsQuery( const String & );
+void printGrblSettings();
+float getGrblSetting( GRBL_SETTING id, float fallback );
+float getGrblAxisSetting( GRBL_SETTING base, uint8_t axis, float fallback );
+String grblSettingsSnapshot();
+void restoreGrblSettings( const String & );
+//
+
+//Job progress related stuff here
+void trackProgress( const String & );
+void progressLineAcknowledged();
+void resetProgress();
+void startJob( uint32_t lines );
+void progressLinesMerged( uint32_t lines );
+void printProgress();
+String appendProgressToStatus( const String & );
+const char *parseGcodeNumber( const char *c, float &value );
+//
+
+//Line acknowledgement related stuff here
+void resetAckTracker();
+void trackSentLines( const String &, bool internal, uint8_t merged = 0 );
+bool ackLineCompleted( uint8_t &merged, bool &settingWrite );
+bool ackOldestInternal();
+uint8_t linesInFlight();
+uint16_t bytesInFlight();
+void serviceAckTracker();
+bool statusProbeAnswered();
+void resetAckStats();
+void printAckStats();
+//
+
+//Framed host protocol related stuff here
+extern bool b_framedMode;
+
+void beginFramedMode();
+void endFramedMode();
+void readHostFrames();
+void handleFrameData( const uint8_t *, uint16_t );
+void serviceHostFrames();
+void sendHostText( const String & );
+void frameLineCompleted();
+void serviceFrameQueue();
+void clearFrameQueue();
+void flushFrameAcks();
+//
+
+//Compressed block related stuff here
+void resetDecompressor();
+void decompressBlock( const uint8_t *data, uint16_t length, void (*sink)(const uint8_t *, uint16_t) );
+uint32_t decompressedLength( const uint8_t *data, uint16_t length );
+void printDecompressionStats();
+//
+
+//Telemetry related stuff here
+struct TelemetrySnapshot;
+
+void parseStatusReport( const String & );
+void printStatus();
+void printHistory();
+shared_ptr<TelemetrySnapshot> saveTelemetry();
+void restoreTelemetry( const TelemetrySnapshot & );
+//
+
+//Session capture related stuff here
+enum class CAPTURE_RECORD : uint8_t
+{
+	SNAPSHOT = 'S', //state at the start of the capture
+	HOST = 'H', //bytes read from the host
+	GRBL = 'G', //bytes read from GRBL
+	GRBL_OUT = 'g', //bytes sent to GRBL
+	HOST_OUT = 'h', //bytes sent to the host
+	RELAYS_OUT = 'r', //relay actions
+	END = 'E', //byte counts of everything that was sent out during the capture
+};
+
+//Everything the ESP-32 sends out, each kind is recorded and compared on its own.
+enum class SESSION_OUTPUT : uint8_t
+{
+	GRBL,
+	HOST,
+	RELAYS,
+};
+
+#define CAPTURE_OUTPUTS 3 //one per SESSION_OUTPUT
+#define CAPTURE_MAX_RECORD 2048 //longest record that can be captured (and that a replay will accept)
+#define CAPTURE_SNAPSHOT_HEADER 6 //bytes of the snapshot record before the settings
+
+extern bool b_replayActive, //a capture is being replayed (host builds only)
+			b_replayStopped,
+			b_outputMuted; //nothing may reach GRBL, the host or the relays (during a replay or a benchmark).
+extern uint32_t capture_limit; //kB
+
+void captureChunk( CAPTURE_RECORD type, const uint8_t *data, uint16_t length );
+void recordSessionOutput( SESSION_OUTPUT output, const uint8_t *data, size_t length );
+void recordPeripheralAction( const String &name, bool enabled );
+void beginCapture();
+void endCapture();
+void dumpCapture();
+void serviceCaptureDump();
+void printCaptureStatus();
+void restoreSettingsSnapshot( const String &snapshot );
+uint32_t getUint32( const uint8_t *in );
+uint8_t relayStates();
+void setRelayStates( uint8_t );
+uint32_t crc32Update( uint32_t, const uint8_t *, size_t );
+#ifdef CNC_NATIVE
+bool replayCapture( const vector<uint8_t> &capture, String &report );
+void replayOutput( uint8_t output, const uint8_t *data, size_t length );
+#endif
+//
+
+//Telemetry server related stuff here
+extern bool b_telemetryEnabled,
+			b_wifiWithBluetooth; //keep WiFi up while a Bluetooth host is connected, the two share the radio
+extern String s_wifiSSID,
+			  s_wifiPassword;
+extern uint32_t telemetry_interval; //msec, shortest time between two updates to a watcher
+
+void serviceTelemetryServer();
+void printTelemetryStatus();
+String base64Encode( const uint8_t *data, size_t length );
+//
+
+//Segment optimizer related stuff here
+extern bool b_optimizerEnabled;
+extern uint16_t optimizer_tolerance; //um, how far a joined move may stray from the moves it replaces
+
+void optimizeForGrbl( const String & );
+void serviceOptimizer();
+void resetOptimizer();
+void resetOptimizerStats();
+void printOptimizerStats();
+uint16_t optimizerBytesHeld();
+//
+
+//Pre-flight related stuff here
+extern bool b_preflightActive; //lines from the host are analyzed instead of sent to GRBL
+extern uint16_t soft_limit[3]; //mm of travel per axis checked by the pre-flight, 0 to use GRBL's $130-$132
+
+void beginPreflight();
+void endPreflight();
+void preflightStream( const String & );
+void preflightFile( String );
+//
+
+//Benchmark related stuff here
+#ifdef CNC_BENCHMARK
+bool runBenchmarks();
+#endif
+//
+
 //
 
 enum class OBJ_TYPE : uint8_t
@@ -102,7 +361,7 @@ struct Peripheral
 			return;
 
 		b_enabled = false;
-		digitalWrite(i_pin, LOW);
+		writePin();
 		sendToHost(MSG_DISABLE + s_name + MSG_NLCR);
 	}
 
@@ -112,18 +371,29 @@ struct Peripheral
 			return;
 
 		b_enabled = true;
-		digitalWrite(i_pin, HIGH);
+		writePin();
 		sendToHost(MSG_ENABLE + s_name + MSG_NLCR);
 	}
 
 	bool Enabled(){ return b_enabled; }
 
 	private:
+	void writePin()
+	{
+		recordPeripheralAction(s_name, b_enabled);
+		if ( !b_outputMuted ) //the relays stay as they are during a replay or a benchmark
+			digitalWrite(i_pin, b_enabled ? HIGH : LOW);
+	}
+
 	bool b_enabled;
 	uint8_t i_pin;
 	String s_name;
 };
 
+extern Peripheral Vacuum,
+				  Lights,
+				  Cooler;
+
 bool strBeginsWith( const String &str, const vector<char> &c );
 bool strBeginsWith( const String &str, const char c );
 
@@ -137,6 +407,8 @@ vector<String> splitString( const String &str, const char splitChar, bool remove
 bool strContains( const String &str, const vector<char> &c );
 bool strContains( const String &str, const char c );
 
+bool isGrblRealtime( uint8_t c ); //'?', '!', '~', 0x18 and everything from 0x80 up, which GRBL acts on as soon as they arrive
+
 
 class Device_Setting
 {
@@ -145,7 +417,7 @@ class Device_Setting
 	Device_Setting( uint8_t *ptr, const String &descriptor ){ i_Type = OBJ_TYPE::TYPE_VAR_UBYTE; data.ui8_Ptr = ptr; s_descriptor = descriptor; }
 	Device_Setting( uint16_t *ptr, const String &descriptor ){ i_Type = OBJ_TYPE::TYPE_VAR_USHORT; data.ui16_Ptr = ptr; s_descriptor = descriptor; }
 	Device_Setting( uint_fast32_t *ptr, const String &descriptor ){ i_Type = OBJ_TYPE::TYPE_VAR_UINT; data.ui_Ptr = ptr; s_descriptor = descriptor; }
-	Device_Setting( String *ptr, const String &descriptor ){ i_Type = OBJ_TYPE::TYPE_VAR_STRING; data.s_Ptr = ptr; s_descriptor = descriptor; }
+	Device_Setting( String *ptr, const String &descriptor, bool secret = false ){ i_Type = OBJ_TYPE::TYPE_VAR_STRING; data.s_Ptr = ptr; s_descriptor = descriptor; b_secret = secret; }
 	virtual ~Device_Setting(){} //destructor
 
 	void setValue( const String &str );
@@ -202,6 +474,8 @@ class Device_Setting
 	}
 	
 	const String &getDescriptor(){ return s_descriptor; }
+	bool isSecret(){ return b_secret; }
+	String displayValue(); //the value as it may be printed or captured, a secret is masked
 
 	private:
 	union
@@ -214,10 +488,82 @@ class Device_Setting
 	} data;
 
 	OBJ_TYPE i_Type; //stored the field type, because we can't cast
+	bool b_secret = false; //never shown once set, such as the WiFi password
 
 	String s_descriptor;
 };
 
+//Machine state, as parsed from GRBL's status reports (<...>).
+struct GRBL_Status
+{
+	GRBL_STATE state;
+	float f_mpos[3], //machine position (mm)
+		  f_wpos[3], //work position (mm)
+		  f_wco[3], //work coordinate offset (mm), only reported by GRBL every so often
+		  f_feed, //current feed rate
+		  f_spindle; //current spindle speed
+
+	uint8_t i_ovFeed, //overrides (percent)
+			i_ovRapid,
+			i_ovSpindle,
+			i_pins, //one bit per input pin, in the order of GRBL_PINS
+			i_bufferBlocks; //free planner blocks
+
+	uint16_t i_bufferBytes; //free bytes in GRBL's RX buffer
+
+	uint32_t i_updateMillis; //time of the last status report
+};
+
+extern GRBL_Status grblStatus;
+
+//Streaming estimate of how long GRBL will take to execute a series of G-code lines. Moves are modelled after GRBL's planner,
+//using trapezoidal velocity profiles and junction deviation. Each move is held until the next one arrives, so that the speed at
+//the junction between them is known. Runs in constant memory.
+class KinematicModel
+{
+	public:
+	KinematicModel(){ reset(); }
+
+	void reset();
+	float addLine( const char *line ); //returns the time (sec) of any move finalized by this line
+	float flush(); //finalizes the held move, coming to a stop at its end
+	float pendingTime(); //time of the held move, assuming it ends in a stop
+
+	float getPosition( uint8_t axis ){ return f_pos[axis]; }
+	float getFeed(){ return f_feed; }
+	bool endOfProgram(){ return b_programEnd; } //true if the last line added contained M2 or M30
+
+	private:
+	float holdMove( const float *entryDir, const float *exitDir, float length, float speed, float accel );
+	float moveTime( float entry, float &exit );
+	float axisLimit( const float *limits, const float *dir );
+	void refreshLimits();
+
+	float f_pos[3], //current position (mm)
+		  f_feed; //current feed rate (mm/min)
+
+	//Machine limits, copied from the GRBL settings mirror whenever it changes
+	uint16_t i_limitsRevision;
+	float f_maxRate[3], //mm/min
+		  f_accel[3], //mm/sec^2
+		  f_junctionDeviation; //mm
+
+	uint8_t i_motion, //modal motion mode (0-3)
+			i_plane; //modal plane, 17-19
+
+	bool b_absolute,
+		 b_inches,
+		 b_programEnd;
+
+	//The move that is waiting for its successor
+	bool b_held;
+	float f_heldLength,
+		  f_heldSpeed, //mm/sec
+		  f_heldAccel, //mm/sec^2
+		  f_heldEntry, //mm/sec
+		  f_heldExitDir[3];
+};
+
 using SETTING_PTR = shared_ptr<Device_Setting>;
 
 extern std::map<String, SETTING_PTR> settingsMap;
@@ -0,0 +1,251 @@
+/*
+This file contains the code responsible for mirroring the GRBL controller's own settings ($0 - $132) on the ESP-32.
+The mirror is filled once on connect or reset, and is kept coherent by watching the $n=value writes that pass through to GRBL.
+Each write is held until the reply to that very line comes back, as matched by the ack tracker, and only an "ok" commits it.
+Queries ($$ and $n) are answered from the mirror only while nothing else is on its way to GRBL, so that the answer can't overtake
+the replies to the lines before it, nor miss a write that is still in flight.
+*/
+#include "globaldefs.h"
+#include <deque>
+
+const String &GRBL_CMD_SETTINGS PROGMEM = PSTR("$$\n"),
+             &GRBL_CMD_RESTORE PROGMEM = PSTR("$RST"),
+             &GRBL_MSG_OK PROGMEM = PSTR("ok"),
+             &GRBL_MSG_ERROR PROGMEM = PSTR("error:"),
+             &GRBL_MSG_WELCOME PROGMEM = PSTR("Grbl ");
+
+std::map<uint8_t, String> grblSettings; //raw setting values as reported by GRBL, keyed by setting number.
+
+bool b_grblSettingsValid,
+     b_grblFetchPending, //we have asked GRBL for its settings, and have not yet seen the reply.
+     b_grblFetchRetry; //the last request was refused (GRBL was busy), so try again once idle.
+
+uint16_t i_grblSettingsRevision;
+
+uint16_t i_grblFetchLines; //setting lines that have arrived since we asked for the listing
+
+//A $n=value write that has been sent to GRBL, and is waiting for its reply.
+struct PendingSettingWrite
+{
+    uint8_t i_id;
+    String s_value;
+};
+
+std::deque<PendingSettingWrite> pendingSettingWrites; //in the order they were sent, which is the order GRBL replies in
+
+//Asks GRBL for its complete settings listing. The reply is consumed locally and never reaches the host.
+void requestGrblSettings()
+{
+    b_grblFetchPending = true;
+    b_grblFetchRetry = false;
+    i_grblFetchLines = 0;
+    sendInternalToGrbl(GRBL_CMD_SETTINGS);
+}
+
+//Called while GRBL is idle, retries a refused settings request.
+void serviceGrblSettings()
+{
+    if ( b_grblFetchRetry && !b_grblFetchPending )
+        requestGrblSettings();
+}
+
+//Splits a "$n=value" line into its setting number and value. Returns false if the line is not a setting.
+bool splitGrblSetting( const String &line, uint8_t &id, String &value )
+{
+    if ( line.length() < 4 || line[0] != '$' || !isDigit(line[1]) )
+        return false;
+
+    int equals = line.indexOf(CHAR_EQUALS);
+    if ( equals < 2 )
+        return false;
+
+    id = static_cast<uint8_t>(line.substring(1, equals).toInt());
+    value = line.substring(equals + 1);
+
+    int space = value.indexOf(' '); //GRBL 0.9 appends a description to each setting
+    if ( space >= 0 )
+        value.remove(space);
+
+    value.trim();
+    return value.length() > 0;
+}
+
+//Called by the ack tracker with every line that is sent to GRBL. Returns true for a $n=value write, which is held until its reply.
+bool trackSettingWrite( const String &line )
+{
+    PendingSettingWrite write;
+    if ( !splitGrblSetting(line, write.i_id, write.s_value) )
+        return false;
+
+    pendingSettingWrites.push_back(write);
+    return true;
+}
+
+//Forgets the writes in flight, GRBL will never answer them.
+void clearSettingWrites()
+{
+    pendingSettingWrites.clear();
+}
+
+//After a reset of the ESP-32 alone, GRBL may still answer lines the host sent before it. An "ok" that arrives while our own $$ is the
+//oldest line in flight, before any of the setting lines, is one of those: the listing always comes first. It belongs to the host.
+bool strayGrblOk( const String &msg )
+{
+    return b_grblFetchPending && !i_grblFetchLines && ackOldestInternal() && msg.startsWith(GRBL_MSG_OK);
+}
+
+//Inspects a single reply line from GRBL. Internal is set if the line is the "ok" or "error:" for a request the ESP-32 sent itself,
+//settingWrite if it is the reply to a $n=value write. Returns true if the line was consumed by the mirror and should not be forwarded
+//to the host.
+bool parseGrblSettingsReply( const String &msg, bool internal, bool settingWrite )
+{
+    String line = msg;
+    line.trim();
+
+    uint8_t id;
+    String value;
+    if ( splitGrblSetting(line, id, value) )
+    {
+        grblSettings[id] = value;
+        i_grblSettingsRevision++;
+        if ( b_grblFetchPending )
+            i_grblFetchLines++;
+        return b_grblFetchPending; //unless the host asked for these itself
+    }
+
+    if ( settingWrite && pendingSettingWrites.size() )
+    {
+        if ( line == GRBL_MSG_OK ) //GRBL accepted it, commit it to the mirror. Otherwise the mirror is still correct.
+        {
+            grblSettings[pendingSettingWrites.front().i_id] = pendingSettingWrites.front().s_value;
+            i_grblSettingsRevision++;
+        }
+        pendingSettingWrites.pop_front();
+        return false;
+    }
+
+    if ( internal ) //end of our own $$ listing
+    {
+        b_grblFetchPending = false;
+        if ( line == GRBL_MSG_OK && i_grblFetchLines )
+        {
+            b_grblSettingsValid = true;
+            i_grblSettingsRevision++;
+        }
+        else //our request was refused, usually because a job is running.
+            b_grblFetchRetry = true;
+
+        return true;
+    }
+
+    if ( line.startsWith(GRBL_MSG_WELCOME) ) //GRBL has just been reset, so read everything again.
+    {
+        b_grblSettingsValid = false;
+        i_grblSettingsRevision++;
+        requestGrblSettings();
+    }
+
+    return false;
+}
+
+//True if a query can be answered from the mirror: it holds the whole listing, and GRBL has nothing to reply to before the query.
+//Lines from the same host chunk that are still to be forwarded count as well.
+bool grblSettingsAnswerable()
+{
+    return b_grblSettingsValid && !linesInFlight() && !optimizerBytesHeld() && !b_hostLinesAhead;
+}
+
+//Watches a single command word that is being forwarded to GRBL, and answers setting queries from the mirror when possible.
+//Returns true if the command has been answered locally and must not be forwarded.
+bool handleGrblSettingsQuery( const String &cmd )
+{
+    if ( cmd.startsWith(GRBL_CMD_RESTORE) ) //settings are being restored to defaults, read them again once GRBL is done.
+    {
+        b_grblSettingsValid = false;
+        i_grblSettingsRevision++;
+        b_grblFetchRetry = true;
+        return false;
+    }
+
+    if ( !grblSettingsAnswerable() || cmd.length() < 2 || cmd[0] != '$' ) //a $n=value write is seen by trackSettingWrite() as it goes out
+        return false;
+
+    for ( uint8_t x = 1; x < cmd.length(); x++ )
+    {
+        if ( !isDigit(cmd[x]) )
+            return false; //not a single setting query
+    }
+
+    auto itr = grblSettings.find(static_cast<uint8_t>(cmd.substring(1).toInt()));
+    if ( itr == grblSettings.end() )
+        return false; //let GRBL answer for anything we don't know about
+
+    printMessageToHost(String('$') + itr->first + CHAR_EQUALS + itr->second + PSTR("\r\n"));
+    sendOkToHost();
+    return true;
+}
+
+//Prints the mirrored GRBL settings in the same format that GRBL would use.
+void printGrblSettings()
+{
+    for ( auto itr = grblSettings.begin(); itr != grblSettings.end(); itr++ )
+    {
+        printMessageToHost(String('$') + itr->first + CHAR_EQUALS + itr->second + PSTR("\r\n"));
+    }
+}
+
+//Returns a mirrored GRBL setting, or the fallback value if it is not (yet) known.
+float getGrblSetting( GRBL_SETTING id, float fallback )
+{
+    auto itr = grblSettings.find(static_cast<uint8_t>(id));
+    if ( itr == grblSettings.end() )
+        return fallback;
+
+    return itr->second.toFloat();
+}
+
+//Returns a per-axis GRBL setting (steps, rates, accelerations, travel), where axis 0-2 maps to X-Z.
+float getGrblAxisSetting( GRBL_SETTING base, uint8_t axis, float fallback )
+{
+    return getGrblSetting(static_cast<GRBL_SETTING>(static_cast<uint8_t>(base) + axis), fallback);
+}
+
+//Returns the whole mirror as "$n=value" lines, empty if it isn't complete.
+String grblSettingsSnapshot()
+{
+    String snapshot;
+    if ( !b_grblSettingsValid )
+        return snapshot;
+
+    for ( auto itr = grblSettings.begin(); itr != grblSettings.end(); itr++ )
+        snapshot += String('$') + itr->first + CHAR_EQUALS + itr->second + CHAR_NEWLINE;
+
+    return snapshot;
+}
+
+//Replaces the mirror with a snapshot taken by grblSettingsSnapshot(). Any request or write in progress is forgotten.
+void restoreGrblSettings( const String &snapshot )
+{
+    grblSettings.clear();
+    b_grblFetchPending = false;
+    b_grblFetchRetry = false;
+    pendingSettingWrites.clear();
+
+    int start = 0;
+    while ( start < static_cast<int>(snapshot.length()) )
+    {
+        int end = snapshot.indexOf(CHAR_NEWLINE, start);
+        if ( end < 0 )
+            end = snapshot.length();
+
+        uint8_t id;
+        String value;
+        if ( splitGrblSetting(snapshot.substring(start, end), id, value) )
+            grblSettings[id] = value;
+
+        start = end + 1;
+    }
+
+    b_grblSettingsValid = !grblSettings.empty();
+    i_grblSettingsRevision++;
+}
@@ -0,0 +1,418 @@
+/*
+This file contains the optional framed host protocol. Plain text passthrough stays the default, framed mode is entered with the /BIN local command.
+
+Every frame (in both directions) looks like this:
+    0x02 | type (1 byte) | sequence (1 byte) | payload length (2 bytes, LSB first) | payload | CRC-16/CCITT (2 bytes, LSB first)
+The CRC covers the type, sequence, length and payload.
+
+Host to ESP-32:
+    'D' - payload holds one or more G-code (or local) lines. Lines may be split across frames. Sequence numbers must increase by one per frame.
+    'Z' - same as 'D', but the payload is compressed (see lzdecode.cpp). Shares the sequence numbers with 'D'.
+    'X' - leave framed mode.
+    Realtime commands (?, !, ~, 0x18) may also be sent on their own between frames.
+ESP-32 to host:
+    'A' - cumulative acknowledgement. The sequence is the last data frame accepted, the payload holds the total number of lines that
+          GRBL has completed (ok or error:) since framed mode was entered (2 bytes, LSB first, wraps around).
+    'N' - a frame was damaged, out of order, or would overflow the queue. The sequence is the one expected next, the host should
+          resend from there. Frames that were already on their way are ignored without another 'N'. If the frame we asked for is
+          damaged as well, or nothing arrives within FRAME_NAK_TIMEOUT, the 'N' is sent again. After FRAME_NAK_RETRIES of those in a
+          row, the link is given up on and framed mode is left.
+    'T' - text from GRBL or the ESP-32 (everything except the "ok" replies, which are counted in the 'A' frames instead).
+
+Flow control: lines taken out of the frames (after decompression) are queued on the ESP-32, and sent on to GRBL only as its 128 byte
+receive buffer has room for them, counting the bytes of the lines GRBL hasn't answered yet. The host does the same character counting,
+but against the queue: the bytes of the lines it has sent (decompressed, with their line ends), less those of the lines covered by the
+count in the last 'A' frame, must stay within FRAME_QUEUE_SIZE. A frame that would take the queue over that (a 'Z' frame is measured
+by what it decodes to) is refused with an 'N', and nothing in it is used. Local (/) lines are counted in the 'A' frames like any other line.
+A soft reset (0x18) throws away everything that is still queued.
+*/
+#include "globaldefs.h"
+#include <deque>
+
+#define FRAME_START 0x02
+#define FRAME_HEADER_SIZE 4 //type, sequence and length
+#define FRAME_MAX_PAYLOAD 512
+#define FRAME_MAX_LINE 256 //longest line we will hold on to while waiting for its end
+#define FRAME_TIMEOUT 500 //msec, a frame that stops arriving half way through is thrown away
+#define FRAME_NAK_TIMEOUT 1000 //msec of silence from the host after an 'N', before it is sent again
+#define FRAME_NAK_RETRIES 5 //'N' frames sent again in a row, before framed mode is given up on
+#define FRAME_READ_CHUNK 128 //bytes read from the host at a time
+#define FRAME_QUEUE_SIZE 4096 //decoded bytes the host may have waiting on the ESP-32, see the flow control rule above
+#define GRBL_RX_BUFFER 128 //GRBL's serial receive buffer
+
+enum class FRAME_TYPE : uint8_t
+{
+	DATA = 'D',
+	COMPRESSED = 'Z',
+	EXIT = 'X',
+	ACK = 'A',
+	NAK = 'N',
+	TEXT = 'T',
+};
+
+enum class FRAME_STATE : uint8_t
+{
+	WAIT_START,
+	HEADER,
+	PAYLOAD,
+	CRC,
+};
+
+bool b_framedMode;
+
+FRAME_STATE i_frameState;
+uint8_t frameHeader[FRAME_HEADER_SIZE],
+		framePayload[FRAME_MAX_PAYLOAD],
+		frameCRC[2],
+		i_frameExpectedSeq, //next data frame we will accept
+		i_frameOutSeq; //sequence of the frames we send
+uint16_t i_frameBytes, //bytes received of the current header, payload or CRC
+		 i_frameLength,
+		 i_frameLinesDone; //cumulative count sent in 'A' frames
+uint32_t i_frameLastByteMillis,
+		 i_frameNakMillis, //when the last 'N' was sent
+		 i_framesGood,
+		 i_framesBad;
+uint8_t i_frameNakRetries; //'N' frames sent again since the last frame we accepted
+bool b_frameAckPending, //something changed that the host doesn't know about yet
+	 b_frameNakSent; //we have asked for a resend, and are ignoring everything until it arrives
+
+String s_frameLine; //line being put together from the data frames
+
+std::deque<String> frameQueue; //complete lines waiting for room in GRBL's receive buffer
+uint16_t i_frameQueueBytes;
+
+//CRC-16/CCITT (polynomial 0x1021), one nibble at a time to keep the table small.
+uint16_t crc16Update( uint16_t crc, const uint8_t *data, uint16_t length )
+{
+	static const uint16_t table[16] = { 0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+										0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef };
+	for ( uint16_t x = 0; x < length; x++ )
+	{
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (data[x] >> 4)];
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (data[x] & 0x0F)];
+	}
+	return crc;
+}
+
+//Writes a single frame to the host.
+void sendHostFrame( FRAME_TYPE type, uint8_t seq, const uint8_t *payload, uint16_t length )
+{
+	uint8_t header[FRAME_HEADER_SIZE + 1] = { FRAME_START, static_cast<uint8_t>(type), seq, static_cast<uint8_t>(length & 0xFF), static_cast<uint8_t>(length >> 8) };
+	uint16_t crc = crc16Update(0xFFFF, header + 1, FRAME_HEADER_SIZE);
+	crc = crc16Update(crc, payload, length);
+	uint8_t trailer[2] = { static_cast<uint8_t>(crc & 0xFF), static_cast<uint8_t>(crc >> 8) };
+
+	writeToHost(header, sizeof(header));
+	if ( length )
+		writeToHost(payload, length);
+	writeToHost(trailer, sizeof(trailer));
+}
+
+//Sends the cumulative acknowledgement, if anything has changed since the last one.
+void flushFrameAcks()
+{
+	if ( !b_framedMode || !b_frameAckPending )
+		return;
+
+	b_frameAckPending = false;
+	uint8_t count[2] = { static_cast<uint8_t>(i_frameLinesDone & 0xFF), static_cast<uint8_t>(i_frameLinesDone >> 8) };
+	sendHostFrame(FRAME_TYPE::ACK, i_frameExpectedSeq - 1, count, sizeof(count));
+}
+
+//Sends text to the host in 'T' frames. Any pending acknowledgement goes first, so that the host knows which line a message belongs to.
+void sendHostText( const String &msg )
+{
+	flushFrameAcks();
+
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(msg.c_str());
+	for ( uint16_t x = 0; x < msg.length(); x += FRAME_MAX_PAYLOAD )
+	{
+		sendHostFrame(FRAME_TYPE::TEXT, i_frameOutSeq++, data + x, min(msg.length() - x, (unsigned int)FRAME_MAX_PAYLOAD));
+	}
+}
+
+//Called for each "ok" or "error:" reply from GRBL while in framed mode.
+void frameLineCompleted()
+{
+	i_frameLinesDone++;
+	b_frameAckPending = true;
+}
+
+void clearFrameQueue()
+{
+	frameQueue.clear();
+	i_frameQueueBytes = 0;
+}
+
+//Holds a complete line until GRBL has room for it. The frame it came in has already been checked to fit.
+void queueFrameLine( const String &line )
+{
+	frameQueue.push_back(line);
+	i_frameQueueBytes += line.length();
+}
+
+//Sends the queued lines on to GRBL, as long as they fit in its receive buffer next to the lines it hasn't answered yet (and the moves
+//the optimizer is holding, which will need the room later). Local lines are handled as soon as they reach the front.
+void serviceFrameQueue()
+{
+	while ( !frameQueue.empty() )
+	{
+		bool local = strBeginsWith(frameQueue.front(), '/');
+		uint16_t waiting = bytesInFlight() + optimizerBytesHeld();
+		if ( !local && waiting && waiting + frameQueue.front().length() >= GRBL_RX_BUFFER )
+			return;
+
+		String line = frameQueue.front();
+		frameQueue.pop_front();
+		i_frameQueueBytes -= line.length();
+
+		processHostCommand(line);
+		if ( local ) //never answered by GRBL, but the host counts every line it sent
+			frameLineCompleted();
+	}
+}
+
+//Asks the host to resend everything from the frame we expected. Frames that are out of order (or don't fit) are the ones that were
+//already on their way, and are only asked about once. Again is set when the resend itself was damaged or never came, and counts
+//against FRAME_NAK_RETRIES.
+void requestResend( bool again )
+{
+	i_framesBad++;
+	if ( b_frameNakSent && !again )
+		return;
+
+	if ( b_frameNakSent && ++i_frameNakRetries > FRAME_NAK_RETRIES )
+	{
+		printMessageToHost(PSTR("[MSG:No good frame after ") + String(FRAME_NAK_RETRIES) + PSTR(" resend requests]") + MSG_NLCR);
+		endFramedMode();
+		return;
+	}
+
+	b_frameNakSent = true;
+	i_frameNakMillis = millis();
+	sendHostFrame(FRAME_TYPE::NAK, i_frameExpectedSeq, nullptr, 0);
+}
+
+void resetFrameParser()
+{
+	i_frameState = FRAME_STATE::WAIT_START;
+	i_frameBytes = 0;
+}
+
+void beginFramedMode()
+{
+	resetFrameParser();
+	s_frameLine.clear();
+	i_frameExpectedSeq = 0;
+	i_frameOutSeq = 0;
+	i_frameLinesDone = 0;
+	i_framesGood = 0;
+	i_framesBad = 0;
+	b_frameAckPending = false;
+	b_frameNakSent = false;
+	i_frameNakRetries = 0;
+	b_framedMode = true;
+	clearFrameQueue();
+	resetDecompressor();
+}
+
+void endFramedMode()
+{
+	if ( !b_framedMode )
+		return;
+
+	flushFrameAcks();
+	b_framedMode = false;
+	printMessageToHost(PSTR("Framed mode disabled (") + String(i_framesGood) + PSTR(" frames, ") + i_framesBad + PSTR(" rejected)") + MSG_NLCR);
+}
+
+//Takes the lines out of a data frame payload and queues them for GRBL. Lines that are split across frames are held until their end arrives.
+void handleFramePayload( const uint8_t *payload, uint16_t length )
+{
+	for ( uint16_t x = 0; x < length; x++ )
+	{
+		char c = static_cast<char>(payload[x]);
+		if ( isGrblRealtime(payload[x]) ) //realtime commands can't wait for the end of the line
+		{
+			if ( c == 0x18 ) //GRBL drops what it was holding, and so do we
+			{
+				clearFrameQueue();
+				s_frameLine.clear();
+			}
+			forwardToGrbl(String(c));
+			continue;
+		}
+
+		s_frameLine += c;
+		if ( c == CHAR_NEWLINE || s_frameLine.length() >= FRAME_MAX_LINE )
+		{
+			queueFrameLine(s_frameLine);
+			s_frameLine.clear();
+		}
+	}
+}
+
+//A complete frame with a good CRC has arrived.
+void handleFrame()
+{
+	FRAME_TYPE type = static_cast<FRAME_TYPE>(frameHeader[0]);
+	uint8_t seq = frameHeader[1];
+
+	if ( type == FRAME_TYPE::EXIT )
+	{
+		endFramedMode();
+		return;
+	}
+
+	if ( type != FRAME_TYPE::DATA && type != FRAME_TYPE::COMPRESSED )
+		return; //nothing else is expected from the host
+
+	if ( seq == static_cast<uint8_t>(i_frameExpectedSeq - 1) ) //the host missed our acknowledgement and sent the frame again
+	{
+		b_frameAckPending = true;
+		return;
+	}
+
+	if ( seq != i_frameExpectedSeq ) //a frame went missing, ask for everything from the one we expected
+	{
+		requestResend(false);
+		return;
+	}
+
+	uint32_t decoded = type == FRAME_TYPE::COMPRESSED ? decompressedLength(framePayload, i_frameLength) : i_frameLength;
+	if ( i_frameQueueBytes + s_frameLine.length() + decoded > FRAME_QUEUE_SIZE ) //the host went over, it may try again once the acks show room
+	{
+		requestResend(false);
+		return;
+	}
+
+	i_frameExpectedSeq++;
+	b_frameNakSent = false;
+	i_frameNakRetries = 0;
+	i_framesGood++;
+	b_frameAckPending = true;
+
+	if ( type == FRAME_TYPE::COMPRESSED )
+		decompressBlock(framePayload, i_frameLength, handleFramePayload);
+	else
+		handleFramePayload(framePayload, i_frameLength);
+
+	serviceFrameQueue(); //whatever fits goes out right away
+}
+
+//Reads everything the host has sent in small chunks, so that each one can be captured the way it arrived.
+void readHostFrames()
+{
+	Stream &host = hostStream();
+	uint8_t data[FRAME_READ_CHUNK];
+
+	while ( b_framedMode && host.available() )
+	{
+		uint16_t length = 0;
+		while ( length < FRAME_READ_CHUNK && host.available() )
+			data[length++] = static_cast<uint8_t>(host.read());
+
+		captureChunk(CAPTURE_RECORD::HOST, data, length);
+		handleFrameData(data, length);
+	}
+}
+
+//Called once per cycle, meters the queued lines into GRBL and throws away a frame that stopped arriving half way through.
+void serviceHostFrames()
+{
+	serviceFrameQueue(); //also drains what is left after the host leaves framed mode
+
+	if ( b_framedMode && i_frameState != FRAME_STATE::WAIT_START && millis() - i_frameLastByteMillis > FRAME_TIMEOUT )
+	{
+		resetFrameParser();
+		requestResend(true);
+	}
+	else if ( b_framedMode && b_frameNakSent && millis() - i_frameNakMillis > FRAME_NAK_TIMEOUT
+			  && millis() - i_frameLastByteMillis > FRAME_NAK_TIMEOUT ) //the 'N' or the resend got lost
+		requestResend(true);
+}
+
+//Runs the bytes from the host through the frame parser, one byte at a time, and handles each complete frame.
+//Anything that follows the end of framed mode is plain text again.
+void handleFrameData( const uint8_t *data, uint16_t length )
+{
+	uint16_t x = 0;
+	for ( ; x < length && b_framedMode; x++ )
+	{
+		uint8_t c = data[x];
+		i_frameLastByteMillis = millis();
+
+		switch ( i_frameState )
+		{
+			case FRAME_STATE::WAIT_START:
+			{
+				if ( c == FRAME_START )
+				{
+					i_frameState = FRAME_STATE::HEADER;
+					i_frameBytes = 0;
+				}
+				else if ( isGrblRealtime(c) ) //realtime commands are allowed between frames
+				{
+					if ( c == 0x18 )
+					{
+						clearFrameQueue();
+						s_frameLine.clear();
+					}
+					forwardToGrbl(String(static_cast<char>(c)));
+				}
+			}
+			break;
+			case FRAME_STATE::HEADER:
+			{
+				frameHeader[i_frameBytes++] = c;
+				if ( i_frameBytes == FRAME_HEADER_SIZE )
+				{
+					i_frameLength = frameHeader[2] | (frameHeader[3] << 8);
+					i_frameBytes = 0;
+					if ( i_frameLength > FRAME_MAX_PAYLOAD )
+					{
+						resetFrameParser();
+						requestResend(true);
+					}
+					else
+						i_frameState = i_frameLength ? FRAME_STATE::PAYLOAD : FRAME_STATE::CRC;
+				}
+			}
+			break;
+			case FRAME_STATE::PAYLOAD:
+			{
+				framePayload[i_frameBytes++] = c;
+				if ( i_frameBytes == i_frameLength )
+				{
+					i_frameBytes = 0;
+					i_frameState = FRAME_STATE::CRC;
+				}
+			}
+			break;
+			case FRAME_STATE::CRC:
+			{
+				frameCRC[i_frameBytes++] = c;
+				if ( i_frameBytes == 2 )
+				{
+					uint16_t crc = crc16Update(crc16Update(0xFFFF, frameHeader, FRAME_HEADER_SIZE), framePayload, i_frameLength);
+					resetFrameParser();
+
+					if ( crc == (frameCRC[0] | (frameCRC[1] << 8)) )
+						handleFrame();
+					else //damaged, nothing in it may reach GRBL
+						requestResend(true);
+				}
+			}
+			break;
+		}
+	}
+
+	if ( x < length ) //the host left framed mode, the rest is a plain text command
+	{
+		String s_cmd;
+		for ( ; x < length; x++ )
+			s_cmd += static_cast<char>(data[x]);
+		processHostCommand(s_cmd);
+	}
+}
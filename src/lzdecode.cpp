@@ -0,0 +1,200 @@
+/*
+This file contains the streaming decompressor for compressed G-code blocks ('Z' frames in framed mode).
+
+The format is a small window LZSS, so that it fits in the ESP-32's RAM and never needs the whole file:
+    A flag byte comes first, followed by up to 8 items. Bit 0 of the flag byte describes the first item, bit 1 the second, etc.
+    1 - literal, a single byte that is copied to the output as is.
+    0 - match, two bytes: low 8 bits of (offset - 1), then the top 2 bits of (offset - 1) in bits 0-1 and (length - 3) in bits 2-7.
+        Copies 'length' bytes (3 - 66), starting 'offset' bytes (1 - 1024) back in the output.
+The window carries over from one block to the next, until framed mode is entered again.
+A block can decode to several kB. The output goes through the same queue as the lines of a plain data frame, and is metered into GRBL
+the same way (see hostframe.cpp). A block that wouldn't fit in the queue is measured with decompressedLength(), and refused.
+*/
+#include "globaldefs.h"
+
+#define LZ_WINDOW_SIZE 1024 //must be a power of two
+#define LZ_MIN_MATCH 3
+#define LZ_OUTPUT_CHUNK 128 //decoded bytes handed on at a time
+#define LZ_BLOCK_HISTORY 16 //blocks that are kept for the statistics report
+#define LZ_REFERENCE_BAUD 115200 //raw text rate that the compressed link is compared against
+
+//Statistics for a single decoded block.
+struct LZ_BlockStats
+{
+	uint16_t i_in, //compressed bytes
+			 i_out; //decompressed bytes
+	uint32_t i_micros; //decode time, not counting the time spent forwarding the output
+};
+
+uint8_t lzWindow[LZ_WINDOW_SIZE];
+uint16_t i_lzWindowPos;
+
+//Decoder state, kept between blocks since an item may be split across them
+uint8_t i_lzFlags,
+		i_lzItemsLeft, //items left to decode in the current flag group
+		i_lzMatchLow; //first byte of a match, while waiting for the second
+bool b_lzMatchPending;
+
+LZ_BlockStats lzBlocks[LZ_BLOCK_HISTORY];
+uint32_t i_lzBlockCount; //blocks decoded since framed mode was entered, wide enough for any job
+uint32_t i_lzTotalIn,
+		 i_lzTotalOut,
+		 i_lzTotalMicros;
+
+void resetDecompressor()
+{
+	memset(lzWindow, 0, sizeof(lzWindow));
+	i_lzWindowPos = 0;
+	i_lzItemsLeft = 0;
+	b_lzMatchPending = false;
+	i_lzBlockCount = 0;
+	i_lzTotalIn = 0;
+	i_lzTotalOut = 0;
+	i_lzTotalMicros = 0;
+}
+
+//Returns how many bytes a block will decompress to, without decompressing it. The decoder is left as it was.
+uint32_t decompressedLength( const uint8_t *data, uint16_t length )
+{
+	uint8_t flags = i_lzFlags,
+			itemsLeft = i_lzItemsLeft;
+	bool matchPending = b_lzMatchPending;
+	uint32_t total = 0;
+
+	for ( uint16_t x = 0; x < length; x++ )
+	{
+		if ( !itemsLeft )
+		{
+			flags = data[x];
+			itemsLeft = 8;
+			continue;
+		}
+
+		if ( flags & 1 )
+			total++;
+		else if ( !matchPending )
+		{
+			matchPending = true;
+			continue;
+		}
+		else
+		{
+			matchPending = false;
+			total += (data[x] >> 2) + LZ_MIN_MATCH;
+		}
+
+		flags >>= 1;
+		itemsLeft--;
+	}
+	return total;
+}
+
+//Decompresses a single block, handing the output on to the sink in small pieces as it is produced.
+void decompressBlock( const uint8_t *data, uint16_t length, void (*sink)(const uint8_t *, uint16_t) )
+{
+	uint8_t out[LZ_OUTPUT_CHUNK];
+	uint16_t outLength = 0;
+	uint32_t decodeMicros = 0, totalOut = 0, start = micros();
+
+	for ( uint16_t x = 0; x < length; x++ )
+	{
+		uint8_t c = data[x];
+		if ( !i_lzItemsLeft ) //start of a new group
+		{
+			i_lzFlags = c;
+			i_lzItemsLeft = 8;
+			continue;
+		}
+
+		if ( i_lzFlags & 1 ) //literal
+		{
+			lzWindow[i_lzWindowPos] = c;
+			i_lzWindowPos = (i_lzWindowPos + 1) & (LZ_WINDOW_SIZE - 1);
+			out[outLength++] = c;
+		}
+		else if ( !b_lzMatchPending ) //first half of a match
+		{
+			i_lzMatchLow = c;
+			b_lzMatchPending = true;
+			continue; //the item isn't finished yet
+		}
+		else
+		{
+			b_lzMatchPending = false;
+			uint16_t offset = (i_lzMatchLow | ((c & 0x03) << 8)) + 1,
+					 count = (c >> 2) + LZ_MIN_MATCH,
+					 from = (i_lzWindowPos - offset) & (LZ_WINDOW_SIZE - 1);
+
+			while ( count-- ) //byte by byte, the match may overlap the bytes it is producing
+			{
+				uint8_t value = lzWindow[from];
+				from = (from + 1) & (LZ_WINDOW_SIZE - 1);
+				lzWindow[i_lzWindowPos] = value;
+				i_lzWindowPos = (i_lzWindowPos + 1) & (LZ_WINDOW_SIZE - 1);
+				out[outLength++] = value;
+
+				if ( outLength == LZ_OUTPUT_CHUNK )
+				{
+					decodeMicros += micros() - start;
+					sink(out, outLength);
+					totalOut += outLength;
+					outLength = 0;
+					start = micros();
+				}
+			}
+		}
+
+		i_lzFlags >>= 1;
+		i_lzItemsLeft--;
+
+		if ( outLength == LZ_OUTPUT_CHUNK )
+		{
+			decodeMicros += micros() - start;
+			sink(out, outLength);
+			totalOut += outLength;
+			outLength = 0;
+			start = micros();
+		}
+	}
+
+	decodeMicros += micros() - start;
+	if ( outLength )
+	{
+		sink(out, outLength);
+		totalOut += outLength;
+	}
+
+	LZ_BlockStats &block = lzBlocks[i_lzBlockCount++ % LZ_BLOCK_HISTORY];
+	block.i_in = length;
+	block.i_out = static_cast<uint16_t>(totalOut);
+	block.i_micros = decodeMicros;
+
+	i_lzTotalIn += length;
+	i_lzTotalOut += totalOut;
+	i_lzTotalMicros += decodeMicros;
+}
+
+//Reports the ratio and decode cost of the most recent blocks, and what the link is worth compared to raw text.
+void printDecompressionStats()
+{
+	if ( !i_lzTotalIn )
+	{
+		printMessageToHost(PSTR("No compressed blocks received.") + MSG_NLCR);
+		return;
+	}
+
+	uint8_t blocks = static_cast<uint8_t>(min(i_lzBlockCount, static_cast<uint32_t>(LZ_BLOCK_HISTORY)));
+	for ( uint8_t x = 0; x < blocks; x++ )
+	{
+		const LZ_BlockStats &block = lzBlocks[(i_lzBlockCount - blocks + x) % LZ_BLOCK_HISTORY];
+		printMessageToHost(PSTR("Block: ") + String(block.i_in) + PSTR(" -> ") + block.i_out + PSTR(" bytes, ratio ")
+						   + String(block.i_in ? static_cast<float>(block.i_out) / block.i_in : 0, 2) + PSTR(", ") + block.i_micros + PSTR(" usec") + MSG_NLCR);
+	}
+
+	float ratio = static_cast<float>(i_lzTotalOut) / i_lzTotalIn,
+		  decodeRate = i_lzTotalMicros ? i_lzTotalOut * 1000000.0f / i_lzTotalMicros : 0; //bytes/sec the decoder could keep up with
+
+	printMessageToHost(PSTR("Total: ") + String(i_lzBlockCount) + PSTR(" blocks, ") + i_lzTotalIn + PSTR(" -> ") + i_lzTotalOut + PSTR(" bytes, ratio ") + String(ratio, 2)
+					   + PSTR(", decode ") + String(decodeRate / 1000.0f, 1) + PSTR(" kB/sec, equivalent to ")
+					   + static_cast<uint32_t>(LZ_REFERENCE_BAUD * ratio) + PSTR(" baud of raw text") + MSG_NLCR);
+}
@@ -9,6 +9,7 @@
 #define RELAY_VACUUM_PIN 4
 #define RELAY_COOLER_PIN 5
 #define ONBOARD_LED 2
+#define GRBL_READ_CHUNK 64 //bytes read from GRBL at a time
 
 using namespace std;
 
@@ -23,6 +24,7 @@ const char  CHAR_LOCAL_COMMAND = '/', //prefix for local commands to be executed
 			CHAR_MESSAGE_BEGIN = '<',
 			CHAR_MESSAGE_END = '>',
 			CHAR_CMD_MACHINE = 'M',
+			CHAR_CMD_SETTING = '$',
 
 			CHAR_COLON = ':', //indicates a delimiter between object and following data
 			CHAR_COMMA = ',', //used for multiple data splits
@@ -37,7 +39,20 @@ const String &CMD_CONFIG_QUERY PROGMEM = PSTR("$$"), //Also shared with GRBL
 			 &CMD_SAVE_CONFIG PROGMEM = PSTR("S"),
 			 &CMD_LIGHTS PROGMEM= PSTR("L"), //For toggling the lights state manually
 			 &CMD_COOLER PROGMEM = PSTR("C"), //For toggling cooler fan manually
-			 &CMD_VACUUM PROGMEM = PSTR("V"); //For toggling the vacuum state manually
+			 &CMD_VACUUM PROGMEM = PSTR("V"), //For toggling the vacuum state manually
+			 &CMD_PROGRESS PROGMEM = PSTR("P"), //For reporting the progress of the running job
+			 &CMD_STATUS PROGMEM = PSTR("Q"), //For reporting the last known machine state
+			 &CMD_HISTORY PROGMEM = PSTR("H"), //For reporting the recent motion and buffer history
+			 &CMD_FRAMED PROGMEM = PSTR("BIN"), //For switching the host link over to the framed protocol
+			 &CMD_COMPRESSION PROGMEM = PSTR("LZ"), //For reporting how well compressed blocks are doing
+			 &CMD_ACKS PROGMEM = PSTR("ACK"), //For reporting the lines waiting on GRBL and their latency
+			 &CMD_CAPTURE PROGMEM = PSTR("CAP"), //For starting or stopping a session capture (CAP=1, CAP=0), or reporting on it
+			 &CMD_CAPTURE_DUMP PROGMEM = PSTR("CAPDUMP"), //For copying the captured session to the host, to be replayed there
+			 &CMD_BENCHMARK PROGMEM = PSTR("BENCH"), //For running the benchmarks (esp32dev_bench builds only)
+			 &CMD_JOB PROGMEM = PSTR("JOB"), //For announcing a new job and its number of lines (JOB=lines)
+			 &CMD_PREFLIGHT PROGMEM = PSTR("PF"), //For analyzing the lines that follow instead of running them, or a stored job (PF=file)
+			 &CMD_PREFLIGHT_END PROGMEM = PSTR("PFE"), //For ending the analysis started by PF, and reporting on it
+			 &CMD_BOOT PROGMEM = PSTR("BOOT"); //For reporting the boot timings, including when the first line went on to GRBL
 //
 
 //These strings encapsulated below are for nonvolatile settings that are stored in the ESP-32 flash ram.
@@ -47,7 +62,23 @@ const String &CMD_VACUUM_ROUTER PROGMEM = PSTR("VR"),
 			 &CMD_ALARM_TOFF PROGMEM = PSTR("ATOFF"),
 			 &CMD_ALARM_TON PROGMEM = PSTR("ATON"),
 			 &CMD_COOLER_TOFF PROGMEM = PSTR("CTOFF"),
-			 &CMD_SIMULATION PROGMEM = PSTR("SIM");
+			 &CMD_SIMULATION PROGMEM = PSTR("SIM"),
+			 &CMD_ACCELERATION PROGMEM = PSTR("ACC"),
+			 &CMD_PROGRESS_STATUS PROGMEM = PSTR("PRS"),
+			 &CMD_STALL_TIMEOUT PROGMEM = PSTR("STALL"),
+			 &CMD_STALL_ACTIONS PROGMEM = PSTR("STALLA"),
+			 &CMD_LATENCY_SLO PROGMEM = PSTR("SLO"),
+			 &CMD_CAPTURE_LIMIT PROGMEM = PSTR("CAPMAX"),
+			 &CMD_TELEMETRY PROGMEM = PSTR("WS"), //also reports on the telemetry server when used on its own
+			 &CMD_TELEMETRY_INTERVAL PROGMEM = PSTR("WSINT"),
+			 &CMD_WIFI_SSID PROGMEM = PSTR("SSID"),
+			 &CMD_WIFI_PASSWORD PROGMEM = PSTR("WPASS"),
+			 &CMD_WIFI_WITH_BLUETOOTH PROGMEM = PSTR("WSBT"),
+			 &CMD_OPTIMIZER PROGMEM = PSTR("OPT"), //also reports on the segment optimizer when used on its own
+			 &CMD_OPTIMIZER_TOLERANCE PROGMEM = PSTR("OPTTOL"),
+			 &CMD_SOFT_LIMIT_X PROGMEM = PSTR("SLX"),
+			 &CMD_SOFT_LIMIT_Y PROGMEM = PSTR("SLY"),
+			 &CMD_SOFT_LIMIT_Z PROGMEM = PSTR("SLZ");
 //
 
 const String &PERIPHERAL_VACUUM PROGMEM = PSTR("Vacuum"),
@@ -56,17 +87,9 @@ const String &PERIPHERAL_VACUUM PROGMEM = PSTR("Vacuum"),
 
 const String &ROUTER_MSG PROGMEM = PSTR(" on router.");
 
-enum class GRBL_STATE : uint8_t 
-{
-	ALARM = 'A',
-	IDLE = 'I',
-	RUN = 'R',
-	JOG = 'J',
-	DOOR = 'D',
-	CHECK = 'C',
-	HOME_HOLD = 'H', //can this also be shared with HOLD?
-	SLEEP = 'S',
-};
+const String &MSG_OK PROGMEM = PSTR("ok"),
+			 &MSG_ERROR PROGMEM = PSTR("error:"),
+			 &MSG_WELCOME PROGMEM = PSTR("Grbl ");
 
 //These correspond to the MXX commands that are generated by most gcode generators for controlling the cutter head.
 enum class MACHINE_COMMANDS : uint8_t 
@@ -95,6 +118,9 @@ SERIAL_STATE i_previousSerialState, //used to differentiate between which serial
 
 GRBL_STATE i_grblState;
 
+String s_grblReply; //holds a partial reply line from the GRBL device until its line terminator arrives.
+bool b_hostLinesAhead;
+
 //Perhaps a few things to consider:
 /*
 - A simple web UI could make remote controlling that much more functional. Maybe allow for batch jobs and sending Gcode over network directly to firmware?
@@ -119,16 +145,20 @@ uint32_t nextAlarmMillis,
 		 alarm_flash_time_on, 
 		 alarm_flash_time_off,
 		 nextCoolerMillis,
-		 cooler_off_delay; 
+		 cooler_off_delay,
+		 default_acceleration,
+		 stall_timeout,
+		 latency_slo;
+
+uint8_t stall_actions;
 
 void setup()
 {
-	BtSerial.begin("CNC");	//Initialize the bluetooth serial interface
-	BtSerial.setPin("1234"); //password (pin) for connecting
 	Serial.begin(SERIAL_BAUD);	//This is the input serial from the host device (controller computer).
 	GRBL.begin(SERIAL_BAUD); //Serial 2 is used for forwarding to the CNC controller board (Arduino).
+	requestGrblSettings(); //fill the GRBL settings mirror, GRBL will also announce itself after any reset.
 
-	i_serialState = SERIAL_STATE::UART;
+	i_previousSerialState = i_serialState = SERIAL_STATE::UART; //no reset in the first loop(), GRBL is only reset when the host changes
 	i_grblState = GRBL_STATE::IDLE;
 
 	pinMode(ONBOARD_LED, OUTPUT);
@@ -139,24 +169,38 @@ void setup()
 	b_lightsOnRouter = false; //save these off in flash ram perhaps? Update each time the values change?
 	b_vacuumOnRouter = false;
 	b_simulationMode = false;
+	b_progressInStatus = false;
 
 	alarm_flash_time_on = 5000;
 	alarm_flash_time_off = 1000; 
 	cooler_off_delay = 1000;
-
-	if ( !SPIFFS.begin(true) ) //Format on fail = true.
-		printMessageToHost(PSTR("Failed to initialize SPIFFS storage system.") + MSG_NLCR);
-	else
-	{
-		b_FSOpen = true; //set true if begin works
-		loadSettings();
-	}
+	default_acceleration = 100;
+	stall_timeout = 30000;
+	stall_actions = static_cast<uint8_t>(ACK_ACTION::NOTIFY);
+	latency_slo = 0;
+	capture_limit = 256;
+	b_telemetryEnabled = false;
+	b_wifiWithBluetooth = false;
+	telemetry_interval = 100;
+	b_optimizerEnabled = false;
+	optimizer_tolerance = 5;
+	resetOptimizer();
+	soft_limit[0] = soft_limit[1] = soft_limit[2] = 0; //GRBL's own travel settings
+
+	generateSettingsMap();
+	restoreBootSnapshot(); //settings and lights from before a reset, until the settings file has been read
+	startBootTask(); //Bluetooth, SPIFFS and the settings file are brought up in the background, see boot.cpp
 }
 
 //resets both local and GRBL controller states.
 void reset()
 {
-	GRBL.print(GRBL_CMD_RESET); //should stop spindle, etc, also stops all jobs
+	writeToGrbl(String(GRBL_CMD_RESET)); //should stop spindle, etc, also stops all jobs
+	resetProgress();
+	resetAckTracker();
+	resetOptimizer();
+	clearFrameQueue(); //GRBL has been reset, none of it may reach it now
+	b_framedMode = false; //a new host always starts out talking plain text
 	Vacuum.Disable(); //also disable the vacuum relay, if active.
 	
 	digitalWrite(ONBOARD_LED, (i_serialState == SERIAL_STATE::BLUETOOTH ? HIGH : LOW) ); //Status LED update
@@ -164,7 +208,7 @@ void reset()
 
 void loop()
 {
-	i_serialState = (BtSerial.hasClient() ? SERIAL_STATE::BLUETOOTH : SERIAL_STATE::UART ); //check the state each cycle.
+	i_serialState = (b_bluetoothReady && BtSerial.hasClient() ? SERIAL_STATE::BLUETOOTH : SERIAL_STATE::UART ); //check the state each cycle.
 
 	if ( i_serialState != i_previousSerialState )
 	{
@@ -174,28 +218,63 @@ void loop()
 
 	if (GRBL.available()) // Does the GRBL device have something to say? (takes priority)
 	{	
-		String s_reply = "";
-		while ( GRBL.available() )
-		{
-			s_reply += (char)GRBL.read();
-		}
-
-		sendToHost(s_reply);
+		readFromGrbl();
 	}
 	else //We are transmitting something to the controller(s)
 	{
-		String s_cmd = readFromHost(); //read and store incoming data from host, also handle actions to be taken on commands sent to GRBL device.
-		if ( s_cmd.length() ) //must have a valid command to send to controller
+		if ( b_framedMode )
+			readHostFrames(); //lines are taken out of the frames as they arrive
+		else
 		{
-			if (strBeginsWith(s_cmd, CHAR_LOCAL_COMMAND)) //Looks like this is a local command (For controlling peripherals)
+			String s_cmd = readFromHost(); //read and store incoming data from host, also handle actions to be taken on commands sent to GRBL device.
+			if ( s_cmd.length() ) //must have a valid command to send to controller
 			{
-				handleLocalCommand(removeFromStr(s_cmd, {CHAR_NEWLINE, CHAR_CARRIAGE, CHAR_LOCAL_COMMAND} ) ); //only use the first char of the returned string.
+				captureChunk(CAPTURE_RECORD::HOST, reinterpret_cast<const uint8_t *>(s_cmd.c_str()), s_cmd.length());
+				processHostCommand(s_cmd);
 			}
-			else
-				GRBL.print(handleCommandInteractions( s_cmd )); //not a local command, so send to the controller board.
 		}
 	}
 
+	serviceMachineState();
+	serviceBoot(); //picks up Bluetooth, SPIFFS and the settings once the background initialization is done
+
+	if ( b_bootComplete ) //WiFi is only brought up once the settings are known
+		serviceTelemetryServer();
+}
+
+//Reads what GRBL has sent in small chunks, so that each one can be captured the way it arrived.
+void readFromGrbl()
+{
+	uint8_t data[GRBL_READ_CHUNK];
+	while ( GRBL.available() )
+	{
+		uint16_t length = 0;
+		while ( length < GRBL_READ_CHUNK && GRBL.available() )
+			data[length++] = static_cast<uint8_t>(GRBL.read());
+
+		captureChunk(CAPTURE_RECORD::GRBL, data, length);
+		handleGrblData(data, length);
+	}
+}
+
+//GRBL terminates every reply, so hand them over one complete line at a time.
+void handleGrblData( const uint8_t *data, uint16_t length )
+{
+	for ( uint16_t x = 0; x < length; x++ )
+	{
+		char c = static_cast<char>(data[x]);
+		s_grblReply += c;
+		if ( c == CHAR_NEWLINE )
+		{
+			sendToHost(s_grblReply);
+			s_grblReply.clear();
+		}
+	}
+}
+
+//Everything that is done once per cycle, whether anything was received or not.
+void serviceMachineState()
+{
 	switch(i_grblState)
 	{
 		case GRBL_STATE::SLEEP:
@@ -224,6 +303,11 @@ void loop()
 		}
 		break;
 
+		case GRBL_STATE::IDLE:
+		{
+			serviceGrblSettings(); //retry reading GRBL's settings if it was busy before.
+		}
+		break;
 		case GRBL_STATE::JOG:
 		case GRBL_STATE::RUN:
 		{
@@ -241,6 +325,64 @@ void loop()
 	{
 		Cooler.Disable(); //time is up. Turn off
 	}
+
+	serviceOptimizer(); //before the ack tracker, so a held move that goes out is watched from the start
+	serviceAckTracker();
+	serviceHostFrames();
+	flushFrameAcks(); //one acknowledgement for everything GRBL completed during this cycle
+	serviceCaptureDump();
+}
+
+//Puts everything that depends on earlier traffic back to a known state, so that a captured session replays the same way.
+void resetSession()
+{
+	s_grblReply.clear();
+	resetProgress();
+	resetAckTracker();
+	resetAckStats();
+	resetOptimizer();
+	resetOptimizerStats();
+	clearFrameQueue();
+	nextAlarmMillis = millis();
+	nextCoolerMillis = millis();
+}
+
+bool bluetoothHostConnected()
+{
+	return i_serialState == SERIAL_STATE::BLUETOOTH;
+}
+
+//Decides whether a command from the host is meant for the ESP-32 itself, or is to be forwarded to the GRBL device.
+void processHostCommand( const String &s_cmd )
+{
+	if (strBeginsWith(s_cmd, CHAR_LOCAL_COMMAND)) //Looks like this is a local command (For controlling peripherals)
+	{
+		handleLocalCommand(removeFromStr(s_cmd.substring(1), {CHAR_NEWLINE, CHAR_CARRIAGE} ) ); //only the leading / is the prefix, a path (PF=/jobs/part.nc) keeps its own.
+	}
+	else if ( b_preflightActive )
+		preflightStream(s_cmd); //analyzed only, nothing reaches GRBL until the pre-flight ends.
+	else if ( b_optimizerEnabled )
+		optimizeForGrbl(handleCommandInteractions( s_cmd )); //G1 moves may be joined before they go to the controller board.
+	else
+		forwardToGrbl(handleCommandInteractions( s_cmd )); //not a local command, so send to the controller board.
+}
+
+//Acknowledges a line that was answered by the ESP-32 itself, in the same way GRBL would.
+void sendOkToHost()
+{
+	if ( b_framedMode )
+		frameLineCompleted();
+	else
+		printMessageToHost(MSG_OK + PSTR("\r\n"));
+}
+
+//Returns the interface that the host is currently connected through.
+Stream &hostStream()
+{
+	if ( i_serialState == SERIAL_STATE::BLUETOOTH )
+		return BtSerial;
+
+	return Serial;
 }
 
 //This function is responsible for reading, interpreting, and forwarding messages from a host computer to the GRBL controller.
@@ -268,20 +410,96 @@ String readFromHost()
 	return s_cmd;
 }
 
+//Sends data on to the GRBL device. Everything that goes out passes through here, so that the job progress can be followed.
+void forwardToGrbl( const String &data, uint8_t merged )
+{
+	if ( !data.length() )
+		return;
+
+	if ( !i_firstForwardMillis && (!b_outputMuted || b_replayActive) ) //a replay goes the way the session went, a benchmark is not a forward
+	{
+		for ( uint16_t x = 0; x < data.length() && !i_firstForwardMillis; x++ )
+		{
+			if ( !isGrblRealtime(data[x]) ) //the first line, not a status poll
+				i_firstForwardMillis = millis(); //reported in the boot banner
+		}
+	}
+
+	writeToGrbl(data);
+	trackProgress(data);
+	trackSentLines(data, false, merged);
+}
+
+//Sends a request of the ESP-32's own to the GRBL device. The reply is tracked, but never reaches the host.
+void sendInternalToGrbl( const String &data )
+{
+	writeToGrbl(data);
+	trackSentLines(data, true);
+}
+
+//Everything for the GRBL device goes out through here. Muted while a capture is being replayed, or a benchmark is running.
+void writeToGrbl( const String &data )
+{
+	recordSessionOutput(SESSION_OUTPUT::GRBL, reinterpret_cast<const uint8_t *>(data.c_str()), data.length());
+	if ( !b_outputMuted )
+		GRBL.print(data);
+}
+
+//Everything for the host goes out through here, on whichever interface it is connected through. Muted while a capture is being replayed, or a benchmark is running.
+void writeToHost( const uint8_t *data, size_t length )
+{
+	recordSessionOutput(SESSION_OUTPUT::HOST, data, length);
+	if ( !b_outputMuted )
+		hostStream().write(data, length);
+}
+
 //Forwards a message directly to the host via the appropriate interface.
 void printMessageToHost( const String &msg )
 {
-	if ( i_serialState == SERIAL_STATE::BLUETOOTH )
+	if ( b_framedMode )
 	{
-		BtSerial.print(msg);
+		sendHostText(msg);
+		return;
 	}
-	else
-		Serial.print(msg);
+
+	writeToHost(reinterpret_cast<const uint8_t *>(msg.c_str()), msg.length());
 }
 
 //Parses a message for updates coming from the GRBL device before sending it to the host device. 
 void sendToHost( const String &msg )
 {
+	uint8_t merged = 0; //host lines the optimizer joined into the completed line, they get their "ok" along with it
+	bool lineCompleted = msg.startsWith(MSG_OK) || msg.startsWith(MSG_ERROR), //GRBL has taken the oldest line we sent it.
+		 stray = lineCompleted && strayGrblOk(msg), //for a line sent before the ESP-32 was reset, not the oldest one we know of
+		 settingWrite = false,
+		 internal = lineCompleted && !stray && ackLineCompleted(merged, settingWrite),
+		 welcome = msg.startsWith(MSG_WELCOME);
+
+	if ( welcome ) //GRBL was reset, whatever it was holding is gone.
+	{
+		resetAckTracker();
+		resetProgress();
+	}
+
+	if ( parseGrblSettingsReply(msg, internal, settingWrite) )
+		return; //reply to a request made by the ESP-32 itself, the host never asked for it.
+
+	if ( lineCompleted )
+	{
+		progressLineAcknowledged();
+
+		if ( b_framedMode ) //counted in the next acknowledgement frame rather than sent one by one
+		{
+			if ( msg.startsWith(MSG_ERROR) )
+				printMessageToHost(msg);
+
+			frameLineCompleted();
+			while ( merged-- )
+				frameLineCompleted();
+			return;
+		}
+	}
+
 	if ( !strBeginsWith(msg, {CHAR_MESSAGE_BEGIN, CHAR_FEEDBACK_BEGIN}) ) //not feedback nor a message
 	{
 		vector<String> replies = splitString(msg, CHAR_COLON);
@@ -300,9 +518,20 @@ void sendToHost( const String &msg )
 		{
 			i_grblState = (GRBL_STATE)*replies[0].begin(); //update local GRBL state with first letter of status word.
 		}
+
+		parseStatusReport(msg); //keep the rest of the report too (positions, feed, overrides, pins, buffer)
+
+		if ( !statusProbeAnswered() ) //asked for by the stall check, not the host
+			printMessageToHost(appendProgressToStatus(msg));
+		return;
 	}
 	
 	printMessageToHost(msg);
+	while ( merged-- )
+		sendOkToHost();
+
+	if ( welcome && b_bootComplete ) //the host sees how long the ESP-32 took to come up as well
+		printBootBanner();
 }
 
 //This function handles commands that pertain to the local (ESP-32) device operation (not the GRBL controller). 
@@ -311,6 +540,10 @@ void handleLocalCommand(const String &cmd)
 	vector<String> commands = splitString(cmd, CHAR_SPACE);
 	for ( uint8_t x = 0; x < commands.size(); x++ )
 	{
+		if ( strBeginsWith(commands[x], CHAR_LOCAL_COMMAND) ) //several commands on one line may each have their own prefix (/L /C)
+			commands[x].remove(0, 1);
+
+		String s_original = commands[x]; //setting values (such as the WiFi password) keep their case
 		commands[x].toUpperCase();
 
 		if ( commands[x] == CMD_LIGHTS )
@@ -336,16 +569,96 @@ void handleLocalCommand(const String &cmd)
 		{
 			saveSettings(); //store current settings to the integrated flash memory
 		}
+		else if ( commands[x] == CMD_PROGRESS )
+		{
+			printProgress();
+		}
+		else if ( commands[x] == CMD_STATUS )
+		{
+			printStatus();
+		}
+		else if ( commands[x] == CMD_HISTORY )
+		{
+			printHistory();
+		}
+		else if ( commands[x] == CMD_FRAMED )
+		{
+			printMessageToHost(PSTR("Framed mode enabled.") + MSG_NLCR); //last plain text message
+			beginFramedMode();
+		}
+		else if ( commands[x] == CMD_COMPRESSION )
+		{
+			printDecompressionStats();
+		}
+		else if ( commands[x] == CMD_ACKS )
+		{
+			printAckStats();
+		}
+		else if ( commands[x] == CMD_CAPTURE )
+		{
+			printCaptureStatus();
+		}
+		else if ( commands[x] == CMD_CAPTURE_DUMP )
+		{
+			dumpCapture();
+		}
+		else if ( commands[x] == CMD_TELEMETRY )
+		{
+			printTelemetryStatus();
+		}
+		else if ( commands[x] == CMD_OPTIMIZER )
+		{
+			printOptimizerStats();
+		}
+		else if ( commands[x] == CMD_PREFLIGHT )
+		{
+			beginPreflight();
+		}
+		else if ( commands[x] == CMD_PREFLIGHT_END )
+		{
+			endPreflight();
+		}
+		else if ( commands[x] == CMD_BOOT )
+		{
+			printBootBanner();
+		}
+#ifdef CNC_BENCHMARK
+		else if ( commands[x] == CMD_BENCHMARK )
+		{
+			runBenchmarks();
+		}
+#endif
 		else //See if this is a configuration value rather than a single shot command. If it exists, update its value. 
 		{
 			vector<String> otherCmd = splitString(commands[x], CHAR_EQUALS);
 			if (otherCmd.size() > 1) 
 			{
+				if ( otherCmd[0] == CMD_JOB ) //not a stored setting, just tells us how long the next job is.
+				{
+					startJob(otherCmd[1].toInt());
+					printMessageToHost(PSTR("Job started: ") + otherCmd[1] + PSTR(" lines") + MSG_NLCR);
+					continue;
+				}
+				else if ( otherCmd[0] == CMD_CAPTURE )
+				{
+					if ( otherCmd[1].toInt() )
+						beginCapture();
+					else
+						endCapture();
+					continue;
+				}
+				else if ( otherCmd[0] == CMD_PREFLIGHT )
+				{
+					preflightFile(s_original.substring(s_original.indexOf(CHAR_EQUALS) + 1));
+					continue;
+				}
+
 				settings_itr = settingsMap.find(otherCmd[0]);
 				if ( settings_itr != settingsMap.end() )
 				{
-					settings_itr->second->setValue(otherCmd[1]);
-					printMessageToHost( settings_itr->first + PSTR(" set to: ") + settings_itr->second->getValue<String>() + MSG_NLCR );
+					settings_itr->second->setValue(s_original.substring(s_original.indexOf(CHAR_EQUALS) + 1));
+					noteRuntimeSetting(settings_itr->first);
+					printMessageToHost( settings_itr->first + PSTR(" set to: ") + settings_itr->second->displayValue() + MSG_NLCR );
 				}
 				else //Couldn't find the setting in the settings map, let the user know.
 				{
@@ -357,7 +670,29 @@ void handleLocalCommand(const String &cmd)
 }
 
 //This function dictates whether or not the ESP-32 should react to commands that are being forwarded to the GRBL device, or which actions should be taken.
+//The host may send several lines at once, each one is handled on its own. Returns what should be forwarded in their place.
 String handleCommandInteractions( const String &cmd )
+{
+	int newline = cmd.indexOf(CHAR_NEWLINE);
+	if ( newline < 0 || newline == static_cast<int>(cmd.length()) - 1 ) //the usual case, a single line
+		return handleLineInteractions(cmd);
+
+	String forward;
+	for ( int start = 0; start < static_cast<int>(cmd.length()); start = newline + 1 )
+	{
+		newline = cmd.indexOf(CHAR_NEWLINE, start);
+		if ( newline < 0 )
+			newline = cmd.length() - 1; //partial line, the rest follows in the next read
+
+		b_hostLinesAhead = forward.length();
+		forward += handleLineInteractions(cmd.substring(start, newline + 1));
+	}
+	b_hostLinesAhead = false;
+	return forward;
+}
+
+//Handles a single line from the host (with its line end, if it has one). Returns the line to forward, or an empty String if it was answered locally.
+String handleLineInteractions( const String &cmd )
 {
 	vector<String> cmds = splitString(removeFromStr(cmd, {CHAR_NEWLINE, CHAR_CARRIAGE}), CHAR_SPACE ); //remove extraneous characters before splitting
 	for (uint8_t x = 0; x < cmds.size(); x++ )
@@ -366,10 +701,25 @@ String handleCommandInteractions( const String &cmd )
 
 		if (cmds[x] == CMD_CONFIG_QUERY ) //responds during any state
 		{
+			bool local = grblSettingsAnswerable(); //otherwise GRBL's own listing follows
+			if ( local ) //answer from the mirror, merged with the local settings
+				printGrblSettings();
+
 			for ( settings_itr = settingsMap.begin(); settings_itr != settingsMap.end(); settings_itr++ )
        		{
-				printMessageToHost(settings_itr->first + CHAR_EQUALS + settings_itr->second->getValue<String>() + CHAR_SPACE + CHAR_SPACE + CHAR_SPACE + CHAR_PARENTHESIS_START + settings_itr->second->getDescriptor() + CHAR_PARENTHESIS_END + MSG_NLCR);
+				printMessageToHost(settings_itr->first + CHAR_EQUALS + settings_itr->second->displayValue() + CHAR_SPACE + CHAR_SPACE + CHAR_SPACE + CHAR_PARENTHESIS_START + settings_itr->second->getDescriptor() + CHAR_PARENTHESIS_END + MSG_NLCR);
         	}
+
+			if ( local )
+			{
+				sendOkToHost();
+				return ""; //no need to bother GRBL with this line
+			}
+		}
+		else if ( *cmds[x].begin() == CHAR_CMD_SETTING )
+		{
+			if ( handleGrblSettingsQuery(cmds[x]) )
+				return ""; //this line was answered from the settings mirror
 		}
 
 		else //not a query command
@@ -410,7 +760,7 @@ String handleCommandInteractions( const String &cmd )
 							}
 
 							if ( newCmd.length() )
-								newCmd += MSG_NLCR;
+								newCmd += CHAR_NEWLINE; //a single line end, GRBL answers each '\r' and '\n' on its own
 
 							return newCmd;
 						}
@@ -447,5 +797,5 @@ String handleCommandInteractions( const String &cmd )
 		}
 	}
 
-	return cmd; //forward the inputted command by default
+	return cmd; //forward the inputted line by default
 }
\ No newline at end of file
@@ -0,0 +1,514 @@
+/*
+This file contains the segment optimizer (OPT=1). CAM exports of 3D surfaces are made of long runs of tiny G1 moves that are nearly in
+line with each other, and every one of them costs a line to GRBL, a parse, and a planner block, which limits the feed rate that can
+actually be reached. The optimizer sits between handleCommandInteractions() and forwardToGrbl(), and joins consecutive G1 moves into one
+as long as every point along the way stays within OPTTOL of the joined move (up to OPT_WINDOW moves). The lines it sends also leave
+out the G1 and F words GRBL already has, spaces and trailing zeros.
+
+A joined move is held until it can't grow any more, or until GRBL has nothing left of ours to work on. The host lines that went into it
+are answered together with GRBL's reply to it, so a host counting characters never thinks GRBL has more room than it does.
+Anything that isn't a plain G1 move in absolute coordinates (comments included) goes out as it arrived, after whatever was held.
+*/
+#include "globaldefs.h"
+
+#define OPT_LINE_MAX 96 //GRBL itself only accepts 80 chars per line, anything longer goes out unchanged
+#define OPT_WINDOW 8 //moves that may be joined into one
+#define OPT_NUMBER_MAX 16 //chars in a coordinate or feed value
+#define OPT_IDLE_FLUSH 50 //msec without a new line before a held move goes out anyway
+#define OPT_UM_PER_INCH 25400.0f
+
+const String &MSG_OPTIMIZER PROGMEM = PSTR("Optimizer ");
+
+bool b_optimizerEnabled;
+uint16_t optimizer_tolerance; //um
+
+//A line taken apart into the words the optimizer cares about.
+struct OptimizerLine
+{
+    bool b_mergeable, //nothing on it but G0/G1, X, Y, Z and F
+         b_system, //a "$" line
+         b_unknownPosition; //moves in some way that isn't followed here (homing, probing, offsets, ...)
+    int8_t i_motion, //-1 if not on the line
+           i_distance, //90/91, -1 if not on the line
+           i_units, //20/21, -1 if not on the line
+           i_feedMode; //93/94, -1 if not on the line
+    uint8_t i_axes; //bit per axis word on the line
+    float f_axis[3],
+          f_feed;
+    bool b_feed;
+    char c_axis[3][OPT_NUMBER_MAX],
+         c_feed[OPT_NUMBER_MAX];
+};
+
+//Line assembly
+char c_optLine[OPT_LINE_MAX];
+uint8_t i_optLineLength;
+bool b_optLongLine; //the rest of a line that was too long, sent on unchanged
+uint32_t i_optLastLineMillis;
+
+//Modal state after every line received so far. Anything unknown (-1) is never left out of a line.
+int8_t i_optMotion,
+       i_optDistance,
+       i_optUnits,
+       i_optFeedMode;
+float f_optFeed, //0 if unknown
+      f_optPos[3];
+uint8_t i_optPosKnown; //bit per axis
+
+//What GRBL itself has been sent, which lags behind while a move is held.
+int8_t i_grblMotion;
+float f_grblFeed;
+
+//The moves being held
+uint8_t i_runCount; //0 if nothing is held
+float f_runStart[3],
+      f_runPoints[OPT_WINDOW][3];
+uint8_t i_runAxes; //bit per axis set by any of the moves
+char c_runAxis[3][OPT_NUMBER_MAX],
+     c_runFeed[OPT_NUMBER_MAX]; //empty if the feed doesn't change
+float f_runFeed;
+uint16_t i_runHostBytes; //the held lines as the host counted them
+uint8_t i_runLineEnds; //'\r' and '\n' in the held lines, GRBL would have answered each one
+
+uint32_t i_optLinesIn,
+         i_optLinesOut,
+         i_optBytesIn,
+         i_optBytesOut,
+         i_optMovesIn,
+         i_optMovesOut;
+float f_optMoveLength; //mm (or inches) of the G1 moves that could be joined
+
+//Copies the text of a number, without a plus sign or trailing zeros.
+void copyNumber( char *out, const char *start, const char *end )
+{
+    if ( *start == '+' )
+        start++;
+
+    uint8_t length = 0;
+    for ( const char *c = start; c < end && length < OPT_NUMBER_MAX - 1; c++ )
+        out[length++] = *c;
+
+    if ( memchr(out, '.', length) )
+    {
+        while ( length && out[length - 1] == '0' )
+            length--;
+        if ( length && out[length - 1] == '.' )
+            length--;
+    }
+
+    out[length] = CHAR_NULL;
+    if ( !length || !strcmp(out, "-") || !strcmp(out, "-0") )
+        strcpy(out, "0");
+}
+
+//Takes a line apart. Runs once per line, so it doesn't allocate.
+void parseOptimizerLine( const char *line, OptimizerLine &parsed )
+{
+    memset(&parsed, 0, sizeof(parsed));
+    parsed.b_mergeable = true;
+    parsed.i_motion = parsed.i_distance = parsed.i_units = parsed.i_feedMode = -1;
+
+    for ( const char *c = line; *c; )
+    {
+        char letter = toupper(*c);
+        if ( letter == ' ' || letter == CHAR_CARRIAGE )
+        {
+            c++;
+            continue;
+        }
+        if ( letter == '$' )
+        {
+            parsed.b_system = true;
+            parsed.b_mergeable = false;
+            return;
+        }
+        if ( letter == '(' || letter == ';' ) //comments go out as they are, they may be messages for the host
+        {
+            parsed.b_mergeable = false;
+            if ( letter == ';' )
+                break;
+            while ( *c && *c != ')' )
+                c++;
+            continue;
+        }
+
+        float value;
+        const char *next = parseGcodeNumber(c + 1, value);
+        if ( letter < 'A' || letter > 'Z' || next == c + 1 )
+        {
+            parsed.b_mergeable = false;
+            c++;
+            continue;
+        }
+
+        if ( letter == 'G' )
+        {
+            uint16_t code = static_cast<uint16_t>(value * 10 + 0.5f);
+            switch ( code )
+            {
+                case 0: case 10: case 20: case 30: parsed.i_motion = code / 10; break;
+                case 800: parsed.i_motion = 80; break;
+                case 900: case 910: parsed.i_distance = code / 10; break;
+                case 200: case 210: parsed.i_units = code / 10; break;
+                case 930: case 940: parsed.i_feedMode = code / 10; break;
+                case 40: case 170: case 180: case 190: case 400: case 610: break; //nothing to do with where the machine is
+                default: parsed.b_unknownPosition = true; break; //G10, G28, G38.x, G43.1, G53, G54-59, G92, ...
+            }
+            if ( code > 10 )
+                parsed.b_mergeable = false;
+        }
+        else if ( letter >= 'X' && letter <= 'Z' )
+        {
+            uint8_t axis = letter - 'X';
+            if ( parsed.i_axes & (1 << axis) )
+                parsed.b_mergeable = false; //GRBL rejects it, and will say so
+            parsed.i_axes |= 1 << axis;
+            parsed.f_axis[axis] = value;
+            copyNumber(parsed.c_axis[axis], c + 1, next);
+        }
+        else if ( letter == 'F' )
+        {
+            if ( parsed.b_feed )
+                parsed.b_mergeable = false;
+            parsed.b_feed = true;
+            parsed.f_feed = value;
+            copyNumber(parsed.c_feed, c + 1, next);
+        }
+        else
+            parsed.b_mergeable = false;
+
+        c = next;
+    }
+}
+
+//Follows the modal state and position through a line that went out as it arrived.
+void followLine( const OptimizerLine &line )
+{
+    if ( line.b_system ) //jogging, homing, or startup blocks that may change any of the modes
+    {
+        i_optMotion = -1;
+        i_optDistance = -1;
+        i_optPosKnown = 0;
+    }
+    if ( line.i_motion >= 0 )
+        i_optMotion = line.i_motion;
+    if ( line.i_distance >= 0 )
+        i_optDistance = line.i_distance;
+    if ( line.i_units >= 0 )
+    {
+        if ( line.i_units != i_optUnits )
+            i_optPosKnown = 0; //the position is kept in the units of the lines
+        i_optUnits = line.i_units;
+    }
+    if ( line.i_feedMode >= 0 )
+        i_optFeedMode = line.i_feedMode;
+    if ( line.b_feed )
+        f_optFeed = i_optFeedMode == 94 ? line.f_feed : 0;
+
+    if ( line.b_unknownPosition || i_optMotion < 0 || i_optMotion > 3 )
+    {
+        if ( line.b_unknownPosition )
+            i_optPosKnown = 0;
+        else
+            i_optPosKnown &= ~line.i_axes;
+    }
+    else
+    {
+        for ( uint8_t axis = 0; axis < 3; axis++ )
+        {
+            if ( !(line.i_axes & (1 << axis)) )
+                continue;
+
+            if ( i_optDistance == 90 )
+            {
+                f_optPos[axis] = line.f_axis[axis];
+                i_optPosKnown |= 1 << axis;
+            }
+            else if ( i_optDistance == 91 )
+                f_optPos[axis] += line.f_axis[axis];
+            else
+                i_optPosKnown &= ~(1 << axis);
+        }
+    }
+
+    i_grblMotion = i_optMotion;
+    f_grblFeed = f_optFeed;
+}
+
+//True if the line is a G1 move that may be joined with others. Its end point is put in target.
+bool optimizableMove( const OptimizerLine &line, float *target )
+{
+    int8_t motion = line.i_motion >= 0 ? line.i_motion : i_optMotion;
+    float feed = line.b_feed ? line.f_feed : f_optFeed;
+
+    if ( !line.b_mergeable || !line.i_axes || motion != 1 || feed <= 0 || i_optDistance != 90 || i_optUnits < 0 || i_optFeedMode != 94 || i_optPosKnown != 0x07 )
+        return false;
+
+    for ( uint8_t axis = 0; axis < 3; axis++ )
+        target[axis] = line.i_axes & (1 << axis) ? line.f_axis[axis] : f_optPos[axis];
+
+    return true;
+}
+
+//Distance from point to the segment from start to end.
+float distanceToSegment( const float *point, const float *start, const float *end )
+{
+    float segment[3], offset[3], lengthSq = 0, dot = 0;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        segment[x] = end[x] - start[x];
+        offset[x] = point[x] - start[x];
+        lengthSq += segment[x] * segment[x];
+        dot += segment[x] * offset[x];
+    }
+
+    float t = lengthSq > 0 ? constrain(dot / lengthSq, 0.0f, 1.0f) : 0, distanceSq = 0;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        float d = offset[x] - segment[x] * t;
+        distanceSq += d * d;
+    }
+    return sqrtf(distanceSq);
+}
+
+//The line that would be sent for the held moves, with the given axis words.
+String runLine( uint8_t axes, char axisText[][OPT_NUMBER_MAX] )
+{
+    String line;
+    if ( i_grblMotion != 1 )
+        line += PSTR("G1");
+
+    for ( uint8_t axis = 0; axis < 3; axis++ )
+    {
+        if ( axes & (1 << axis) )
+        {
+            line += static_cast<char>('X' + axis);
+            line += axisText[axis];
+        }
+    }
+
+    if ( *c_runFeed && f_runFeed != f_grblFeed )
+    {
+        line += 'F';
+        line += c_runFeed;
+    }
+
+    return line + CHAR_NEWLINE;
+}
+
+void sendOptimizedLine( const String &line, uint8_t merged )
+{
+    i_optLinesOut++;
+    i_optBytesOut += line.length();
+    forwardToGrbl(line, merged);
+}
+
+//Bytes of the host's lines that are being held. They will take up no more than this in GRBL's buffer once they go out.
+uint16_t optimizerBytesHeld()
+{
+    return i_runCount ? i_runHostBytes : 0;
+}
+
+//Sends the held moves to GRBL as a single line.
+void flushRun()
+{
+    if ( !i_runCount )
+        return;
+
+    sendOptimizedLine(runLine(i_runAxes, c_runAxis), i_runLineEnds - 1); //the joined line only has the one
+    progressLinesMerged(i_runCount - 1);
+    i_optMovesOut++;
+    i_grblMotion = 1;
+    f_grblFeed = f_runFeed;
+    i_runCount = 0;
+}
+
+//Adds the move to the held ones, if the result is still within tolerance and doesn't take more room in GRBL's buffer than the lines did.
+bool joinRun( const OptimizerLine &line, const float *target, uint8_t hostLength )
+{
+    if ( line.b_feed && line.f_feed != f_runFeed )
+        return false;
+
+    float tolerance = optimizer_tolerance / (i_optUnits == 20 ? OPT_UM_PER_INCH : 1000.0f);
+    for ( uint8_t x = 0; x < i_runCount; x++ )
+    {
+        if ( distanceToSegment(f_runPoints[x], f_runStart, target) > tolerance )
+            return false;
+    }
+
+    char axisText[3][OPT_NUMBER_MAX];
+    memcpy(axisText, c_runAxis, sizeof(axisText));
+    for ( uint8_t axis = 0; axis < 3; axis++ )
+    {
+        if ( line.i_axes & (1 << axis) )
+            strcpy(axisText[axis], line.c_axis[axis]);
+    }
+
+    if ( runLine(i_runAxes | line.i_axes, axisText).length() > i_runHostBytes + hostLength )
+        return false;
+
+    memcpy(c_runAxis, axisText, sizeof(c_runAxis));
+    i_runAxes |= line.i_axes;
+    memcpy(f_runPoints[i_runCount++], target, sizeof(f_runPoints[0]));
+    i_runHostBytes += hostLength;
+    return true;
+}
+
+void startRun( const OptimizerLine &line, const float *target, uint8_t hostLength )
+{
+    memcpy(f_runStart, f_optPos, sizeof(f_runStart));
+    memcpy(f_runPoints[0], target, sizeof(f_runPoints[0]));
+    memcpy(c_runAxis, line.c_axis, sizeof(c_runAxis));
+    i_runAxes = line.i_axes;
+    i_runCount = 1;
+    i_runHostBytes = hostLength;
+    i_runLineEnds = 0;
+
+    f_runFeed = line.b_feed ? line.f_feed : f_optFeed;
+    strcpy(c_runFeed, line.b_feed ? line.c_feed : "");
+}
+
+//Called for every complete line from the host.
+void optimizeLine()
+{
+    uint8_t hostLength = i_optLineLength + 1, //with its newline, as the host counts it
+            lineEnds = 1; //and any '\r' in it, such as the first half of a CRLF
+    for ( uint8_t x = 0; x < i_optLineLength; x++ )
+        lineEnds += (c_optLine[x] == CHAR_CARRIAGE);
+    c_optLine[i_optLineLength] = CHAR_NULL;
+    i_optLineLength = 0;
+    i_optLinesIn++;
+    i_optBytesIn += hostLength;
+    i_optLastLineMillis = millis();
+
+    OptimizerLine line;
+    float target[3];
+    parseOptimizerLine(c_optLine, line);
+
+    if ( !optimizableMove(line, target) )
+    {
+        flushRun();
+        sendOptimizedLine(String(c_optLine) + CHAR_NEWLINE, 0);
+        followLine(line);
+        return;
+    }
+
+    float length = 0;
+    for ( uint8_t axis = 0; axis < 3; axis++ )
+        length += (target[axis] - f_optPos[axis]) * (target[axis] - f_optPos[axis]);
+    f_optMoveLength += sqrtf(length);
+    i_optMovesIn++;
+
+    if ( i_runCount && !joinRun(line, target, hostLength) )
+        flushRun();
+
+    if ( !i_runCount )
+        startRun(line, target, hostLength);
+    i_runLineEnds += lineEnds;
+
+    memcpy(f_optPos, target, sizeof(f_optPos));
+    i_optMotion = 1;
+    f_optFeed = f_runFeed;
+
+    if ( i_runCount == OPT_WINDOW )
+        flushRun();
+}
+
+//Takes the place of forwardToGrbl() while the optimizer is enabled. Lines may arrive in pieces.
+void optimizeForGrbl( const String &data )
+{
+    String passthrough; //realtime commands, and the rest of a line that was too long
+    for ( uint16_t x = 0; x < data.length(); x++ )
+    {
+        char c = data[x];
+        if ( isGrblRealtime(c) ) //realtime commands can't wait
+        {
+            if ( c == 0x18 ) //GRBL forgets everything, so do we
+                resetOptimizer();
+            passthrough += c;
+        }
+        else if ( b_optLongLine )
+        {
+            passthrough += c;
+            b_optLongLine = (c != CHAR_NEWLINE);
+        }
+        else if ( c == CHAR_NEWLINE )
+        {
+            if ( passthrough.length() )
+            {
+                forwardToGrbl(passthrough);
+                passthrough.clear();
+            }
+            optimizeLine();
+        }
+        else if ( i_optLineLength == OPT_LINE_MAX - 1 )
+        {
+            flushRun();
+            i_optMotion = -1; //whatever it says is not followed
+            i_optPosKnown = 0;
+            c_optLine[i_optLineLength] = CHAR_NULL;
+            passthrough += String(c_optLine) + c;
+            i_optLineLength = 0;
+            b_optLongLine = true;
+        }
+        else
+            c_optLine[i_optLineLength++] = c;
+    }
+
+    if ( passthrough.length() )
+        forwardToGrbl(passthrough);
+}
+
+//Called once per cycle. Sends the held moves once GRBL has run out of our lines, or the host has gone quiet.
+void serviceOptimizer()
+{
+    if ( !b_optimizerEnabled && i_optLineLength ) //switched off in the middle of a line
+    {
+        c_optLine[i_optLineLength] = CHAR_NULL;
+        forwardToGrbl(String(c_optLine));
+        i_optLineLength = 0;
+    }
+
+    if ( i_runCount && (!b_optimizerEnabled || !linesInFlight() || millis() - i_optLastLineMillis >= OPT_IDLE_FLUSH) )
+        flushRun();
+}
+
+//Drops the held moves and partial line, and forgets the modal state. GRBL has been reset.
+void resetOptimizer()
+{
+    i_optLineLength = 0;
+    b_optLongLine = false;
+    i_runCount = 0;
+    i_optMotion = -1;
+    i_optDistance = -1;
+    i_optUnits = -1;
+    i_optFeedMode = 94; //GRBL's default, a reset can't have changed it
+    f_optFeed = 0;
+    i_optPosKnown = 0;
+    i_grblMotion = -1;
+    f_grblFeed = 0;
+}
+
+void resetOptimizerStats()
+{
+    i_optLinesIn = 0;
+    i_optLinesOut = 0;
+    i_optBytesIn = 0;
+    i_optBytesOut = 0;
+    i_optMovesIn = 0;
+    i_optMovesOut = 0;
+    f_optMoveLength = 0;
+}
+
+//Reports lines and bytes in and out, and how much longer the G1 moves GRBL has to plan have become.
+void printOptimizerStats()
+{
+    float inLength = i_optMovesIn ? f_optMoveLength / i_optMovesIn : 0,
+          outLength = i_optMovesOut ? f_optMoveLength / i_optMovesOut : 0;
+
+    printMessageToHost(MSG_OPTIMIZER + (b_optimizerEnabled ? PSTR("on") : PSTR("off")) + PSTR(" (") + optimizer_tolerance + PSTR(" um): ")
+                       + i_optLinesIn + PSTR(" lines in, ") + i_optLinesOut + PSTR(" out, ") + i_optBytesIn + PSTR(" bytes in, ") + i_optBytesOut
+                       + PSTR(" out (") + (i_optBytesIn - min(i_optBytesIn, i_optBytesOut)) + PSTR(" saved), G1 moves ") + i_optMovesIn + PSTR(" -> ")
+                       + i_optMovesOut + PSTR(", average length ") + String(inLength, 3) + PSTR(" -> ") + String(outLength, 3)
+                       + (inLength > 0 ? String(PSTR(" (x") + String(outLength / inLength, 2) + ')') : String()) + MSG_NLCR);
+}
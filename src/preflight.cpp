@@ -0,0 +1,741 @@
+/*
+This file contains the pre-flight analyzer, which reads a job before it runs and reports what GRBL would make of it: the work envelope
+(checked against the soft limits), spindle and coolant events, tool changes, the feed range, how long it should take, and the lines
+GRBL is going to reject. It makes a single pass in constant memory, one line at a time.
+
+A job can be sent by the host after /PF (every line is answered with "ok" but none of them reach GRBL, /PFE ends it with the report),
+or read from SPIFFS with /PF=<file>. Reports are kept in /pf/, keyed by the CRC-32 of the job and of the settings the report depends on,
+so analyzing the same file again only has to read it once, without parsing it.
+*/
+#include "globaldefs.h"
+
+#define PF_LINE_MAX 128 //longer lines are rejected anyway
+#define PF_GRBL_LINE_MAX 80 //GRBL's line buffer, not counting spaces and comments
+#define PF_READ_BLOCK 512 //bytes read from SPIFFS at a time
+#define PF_REJECTS_LISTED 5 //rejected lines that are listed in the report, the rest are only counted
+#define PF_TOOLS_LISTED 8
+#define PF_CACHE_SLOTS 16 //reports kept in /pf/, a new report replaces whichever one shares its slot
+#define PF_WORD_MAX 8
+#define PF_INCH 25.4f
+#define PF_LOCAL_COMMAND '/' //as CHAR_LOCAL_COMMAND in main.cpp
+
+const String &file_PreflightCache PROGMEM = PSTR("/pf/"),
+             &MSG_PREFLIGHT PROGMEM = PSTR("Pre-flight ");
+
+//The G and M codes GRBL 1.1 accepts, G codes times ten.
+const uint16_t pfGCodes[] PROGMEM = { 0, 10, 20, 30, 40, 100, 170, 180, 190, 200, 210, 280, 281, 300, 301, 382, 383, 384, 385, 400, 431, 490,
+                                      530, 540, 550, 560, 570, 580, 590, 610, 800, 900, 910, 911, 920, 921, 930, 940 };
+const uint8_t pfMCodes[] PROGMEM = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 30, 56 };
+
+bool b_preflightActive; //lines from the host are being analyzed rather than sent to GRBL
+uint16_t soft_limit[3]; //mm of travel per axis, 0 to use GRBL's own ($130-$132)
+
+KinematicModel preflightModel; //not the job model, which belongs to whatever GRBL is running
+
+struct PreflightReject
+{
+    uint32_t i_line;
+    const char *reason;
+    char word[PF_WORD_MAX]; //the offending word, if there is one
+};
+
+//Results of the scan
+uint32_t i_pfLines,
+         i_pfBytes,
+         i_pfCRC,
+         i_pfRejects,
+         i_pfToolChanges,
+         i_pfSpindleOn, //M3 and M4
+         i_pfSpindleOff, //M5
+         i_pfCoolantOn, //M7 and M8
+         i_pfCoolantOff, //M9
+         i_pfPauses; //M0 and M1
+float f_pfMin[3],
+      f_pfMax[3],
+      f_pfFeedMin,
+      f_pfFeedMax,
+      f_pfSpindleMin,
+      f_pfSpindleMax,
+      f_pfSeconds;
+bool b_pfEnded; //M2 or M30 was seen
+uint8_t i_pfEnvelopeAxes; //bit per axis that has a position in f_pfMin and f_pfMax
+uint8_t pfTools[PF_TOOLS_LISTED],
+        i_pfToolCount;
+PreflightReject pfRejects[PF_REJECTS_LISTED];
+
+//Modal state, as GRBL would have it
+uint8_t i_pfMotion,
+        i_pfPlane;
+bool b_pfInches,
+     b_pfInverseTime,
+     b_pfIncremental;
+uint8_t i_pfKnownAxes; //bit per axis whose position the job has set, the model starts out at 0 for the others
+float f_pfFeed,
+      f_pfTool; //selected by the last T word, changed to by M6
+
+//Line assembly
+char c_pfLine[PF_LINE_MAX];
+uint8_t i_pfLineLength;
+bool b_pfLineOverflow;
+
+void resetPreflight()
+{
+    i_pfLines = i_pfBytes = i_pfRejects = i_pfToolChanges = 0;
+    i_pfSpindleOn = i_pfSpindleOff = i_pfCoolantOn = i_pfCoolantOff = i_pfPauses = 0;
+    i_pfCRC = 0xFFFFFFFF;
+    f_pfFeedMin = f_pfSpindleMin = 1e9f;
+    f_pfFeedMax = f_pfSpindleMax = 0;
+    f_pfSeconds = 0;
+    i_pfEnvelopeAxes = 0;
+    b_pfEnded = false;
+    i_pfToolCount = 0;
+
+    i_pfMotion = 0;
+    i_pfPlane = 17;
+    b_pfInches = false;
+    b_pfInverseTime = false;
+    b_pfIncremental = false;
+    i_pfKnownAxes = 0;
+    f_pfFeed = 0;
+    f_pfTool = 0;
+    preflightModel.reset();
+
+    i_pfLineLength = 0;
+    b_pfLineOverflow = false;
+}
+
+void preflightReject( const char *reason, char letter = CHAR_NULL, float value = 0 )
+{
+    if ( i_pfRejects < PF_REJECTS_LISTED )
+    {
+        PreflightReject &reject = pfRejects[i_pfRejects];
+        reject.i_line = i_pfLines;
+        reject.reason = reason;
+        reject.word[0] = CHAR_NULL;
+        if ( letter )
+            snprintf(reject.word, PF_WORD_MAX, "%c%g", letter, value);
+    }
+    i_pfRejects++;
+}
+
+//Adds a point to the envelope, only along the axes whose position is known.
+void includePoint( const float *point, uint8_t axes )
+{
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        if ( !(axes & (1 << x)) )
+            continue;
+
+        bool included = i_pfEnvelopeAxes & (1 << x);
+        f_pfMin[x] = included ? min(f_pfMin[x], point[x]) : point[x];
+        f_pfMax[x] = included ? max(f_pfMax[x], point[x]) : point[x];
+        i_pfEnvelopeAxes |= 1 << x;
+    }
+}
+
+//Adds the points where an arc crosses the axes of its plane, which can be well outside its end points. Needs to know where the arc
+//started in its plane, axes holds the ones that were known.
+void includeArc( const float *start, const float *end, const float *words, uint32_t seen, bool clockwise, uint8_t axes )
+{
+    uint8_t a0 = 0, a1 = 1; //G17
+    if ( i_pfPlane == 18 )
+    {
+        a0 = 2; a1 = 0;
+    }
+    else if ( i_pfPlane == 19 )
+    {
+        a0 = 1; a1 = 2;
+    }
+
+    if ( !(axes & (1 << a0)) || !(axes & (1 << a1)) )
+        return;
+
+    float scale = b_pfInches ? PF_INCH : 1.0f,
+          d0 = end[a0] - start[a0], d1 = end[a1] - start[a1],
+          offset0, offset1;
+
+    if ( seen & (1UL << ('R' - 'A')) ) //the same center GRBL would pick
+    {
+        float radius = words['R' - 'A'] * scale, chord = sqrtf(d0 * d0 + d1 * d1);
+        if ( chord < 1e-6f )
+            return;
+
+        float h = 4 * radius * radius - chord * chord;
+        h = -sqrtf(h > 0 ? h : 0) / chord;
+        if ( !clockwise )
+            h = -h;
+        if ( radius < 0 )
+            h = -h;
+
+        offset0 = 0.5f * (d0 - d1 * h);
+        offset1 = 0.5f * (d1 + d0 * h);
+    }
+    else
+    {
+        const char offsetWords[] = { 'I', 'J', 'K' };
+        offset0 = seen & (1UL << (offsetWords[a0] - 'A')) ? words[offsetWords[a0] - 'A'] * scale : 0;
+        offset1 = seen & (1UL << (offsetWords[a1] - 'A')) ? words[offsetWords[a1] - 'A'] * scale : 0;
+    }
+
+    float center0 = start[a0] + offset0, center1 = start[a1] + offset1,
+          radius = sqrtf(offset0 * offset0 + offset1 * offset1),
+          startAngle = atan2f(-offset1, -offset0),
+          end0 = end[a0] - center0, end1 = end[a1] - center1,
+          sweep = atan2f(-offset0 * end1 + offset1 * end0, -offset0 * end0 - offset1 * end1); //as GRBL's mc_arc(), a full circle when the ends meet
+
+    if ( clockwise && sweep >= -1e-6f )
+        sweep -= 2 * PI;
+    else if ( !clockwise && sweep <= 1e-6f )
+        sweep += 2 * PI;
+
+    for ( uint8_t quadrant = 0; quadrant < 4; quadrant++ )
+    {
+        float angle = quadrant * HALF_PI, along = clockwise ? startAngle - angle : angle - startAngle;
+        along = fmodf(along, 2 * PI);
+        if ( along < 0 )
+            along += 2 * PI;
+        if ( along > fabsf(sweep) )
+            continue;
+
+        float point[3] = { start[0], start[1], start[2] };
+        point[a0] = center0 + radius * cosf(angle);
+        point[a1] = center1 + radius * sinf(angle);
+        includePoint(point, axes);
+    }
+}
+
+template <typename T, size_t N>
+bool codeSupported( const T (&codes)[N], uint16_t code )
+{
+    for ( size_t x = 0; x < N; x++ )
+    {
+        if ( codes[x] == code )
+            return true;
+    }
+    return false;
+}
+
+//Checks a complete line the way GRBL's parser would, and adds what it does to the report.
+void preflightLine( const char *line )
+{
+    i_pfLines++;
+
+    float words[26];
+    uint32_t seen = 0;
+    uint16_t grblLength = 0;
+    int8_t motion = -1;
+    bool toolChange = false, nonModal = false,
+         coordinatesChanged = false; //the work coordinates have moved, or the machine goes somewhere the model doesn't follow
+    uint8_t plane = i_pfPlane;
+
+    for ( const char *c = line; *c; )
+    {
+        char letter = toupper(*c);
+        if ( letter == '(' ) //comment, skip to its end
+        {
+            while ( *c && *c != ')' )
+                c++;
+            if ( *c )
+                c++;
+            continue;
+        }
+        if ( letter == ';' )
+            break;
+        if ( letter == ' ' || letter == '\t' || letter == CHAR_CARRIAGE )
+        {
+            c++;
+            continue;
+        }
+        if ( letter == '$' || letter == '%' ) //not G-code, senders keep these from GRBL's parser
+            return;
+
+        float value;
+        const char *next = parseGcodeNumber(c + 1, value);
+        grblLength += next - c;
+        if ( letter < 'A' || letter > 'Z' || next == c + 1 )
+        {
+            preflightReject(PSTR("bad number format"));
+            return;
+        }
+        c = next;
+
+        if ( letter == 'G' )
+        {
+            uint16_t code = static_cast<uint16_t>(value * 10 + 0.5f);
+            if ( !codeSupported(pfGCodes, code) )
+            {
+                preflightReject(PSTR("unsupported"), letter, value);
+                return;
+            }
+
+            switch ( code )
+            {
+                case 0: case 10: case 20: case 30: case 382: case 383: case 384: case 385: case 800:
+                    if ( motion >= 0 )
+                    {
+                        preflightReject(PSTR("two motion modes"));
+                        return;
+                    }
+                    motion = code < 40 ? code / 10 : 0; //probing is taken as a straight move
+                    if ( code == 800 )
+                        motion = 80;
+                    break;
+                case 170: case 180: case 190: plane = code / 10; break;
+                case 100: case 280: case 281: case 300: case 301: case 530: case 920: case 921: case 431: nonModal = true; break;
+                case 540: case 550: case 560: case 570: case 580: case 590: coordinatesChanged = true; break;
+                default: break;
+            }
+            continue;
+        }
+
+        if ( letter == 'M' )
+        {
+            uint16_t code = static_cast<uint16_t>(value + 0.5f);
+            if ( !codeSupported(pfMCodes, code) )
+            {
+                preflightReject(PSTR("unsupported"), letter, value);
+                return;
+            }
+            continue;
+        }
+
+        if ( !strchr("FIJKLNPRSTXYZ", letter) )
+        {
+            preflightReject(PSTR("unsupported"), letter, value);
+            return;
+        }
+
+        if ( seen & (1UL << (letter - 'A')) )
+        {
+            preflightReject(PSTR("repeated"), letter, value);
+            return;
+        }
+
+        seen |= 1UL << (letter - 'A');
+        words[letter - 'A'] = value;
+    }
+
+    if ( grblLength > PF_GRBL_LINE_MAX || b_pfLineOverflow )
+    {
+        preflightReject(PSTR("longer than 80 chars"));
+        return;
+    }
+
+    const uint32_t axisWords = (1UL << ('X' - 'A')) | (1UL << ('Y' - 'A')) | (1UL << ('Z' - 'A')),
+                   arcWords = (1UL << ('I' - 'A')) | (1UL << ('J' - 'A')) | (1UL << ('K' - 'A')) | (1UL << ('R' - 'A'));
+    uint8_t active = motion >= 0 ? motion : i_pfMotion;
+    bool moves = (seen & axisWords) && !nonModal;
+
+    if ( moves && active >= 1 && active <= 3 && !(seen & (1UL << ('F' - 'A'))) && (b_pfInverseTime || f_pfFeed <= 0) )
+    {
+        preflightReject(PSTR("no feed rate"));
+        return;
+    }
+    if ( moves && (active == 2 || active == 3) && !(seen & arcWords) )
+    {
+        preflightReject(PSTR("arc without I/J/K or R"));
+        return;
+    }
+
+    //GRBL takes the line, follow what it does
+    for ( const char *c = line; *c; c++ ) //modes that only matter here, the model follows the rest itself
+    {
+        char letter = toupper(*c);
+        if ( letter == '(' )
+        {
+            while ( *c && *c != ')' )
+                c++;
+            if ( !*c )
+                break;
+        }
+        else if ( letter == ';' )
+            break;
+        else if ( letter == 'G' || letter == 'M' )
+        {
+            float value;
+            if ( parseGcodeNumber(c + 1, value) == c + 1 )
+                continue;
+
+            uint16_t code = static_cast<uint16_t>(value * (letter == 'G' ? 10 : 1) + 0.5f);
+            if ( letter == 'M' )
+            {
+                if ( code == 3 || code == 4 )
+                    i_pfSpindleOn++;
+                else if ( code == 5 )
+                    i_pfSpindleOff++;
+                else if ( code == 7 || code == 8 )
+                    i_pfCoolantOn++;
+                else if ( code == 9 )
+                    i_pfCoolantOff++;
+                else if ( code == 0 || code == 1 )
+                    i_pfPauses++;
+                else if ( code == 2 || code == 30 )
+                    b_pfEnded = true;
+                else if ( code == 6 )
+                    toolChange = true;
+            }
+            else if ( code == 200 || code == 210 )
+                b_pfInches = (code == 200);
+            else if ( code == 930 || code == 940 )
+                b_pfInverseTime = (code == 930);
+            else if ( code == 900 || code == 910 )
+                b_pfIncremental = (code == 910);
+            else if ( (code == 280 || code == 300) && !(seen & axisWords) ) //all axes go home
+                coordinatesChanged = true;
+            else if ( code == 921 )
+                coordinatesChanged = true;
+        }
+    }
+
+    if ( motion >= 0 )
+        i_pfMotion = motion;
+    i_pfPlane = plane;
+
+    float scale = b_pfInches ? PF_INCH : 1.0f;
+    if ( seen & (1UL << ('F' - 'A')) )
+    {
+        f_pfFeed = words['F' - 'A'];
+        if ( !b_pfInverseTime )
+        {
+            f_pfFeedMin = min(f_pfFeedMin, f_pfFeed * scale);
+            f_pfFeedMax = max(f_pfFeedMax, f_pfFeed * scale);
+        }
+    }
+    if ( seen & (1UL << ('S' - 'A')) )
+    {
+        f_pfSpindleMin = min(f_pfSpindleMin, words['S' - 'A']);
+        f_pfSpindleMax = max(f_pfSpindleMax, words['S' - 'A']);
+    }
+    if ( seen & (1UL << ('T' - 'A')) )
+        f_pfTool = words['T' - 'A'];
+    if ( toolChange )
+    {
+        i_pfToolChanges++;
+        uint8_t tool = static_cast<uint8_t>(f_pfTool);
+        if ( i_pfToolCount < PF_TOOLS_LISTED && !memchr(pfTools, tool, i_pfToolCount) )
+            pfTools[i_pfToolCount++] = tool;
+    }
+
+    float start[3], end[3];
+    for ( uint8_t x = 0; x < 3; x++ )
+        start[x] = preflightModel.getPosition(x);
+
+    f_pfSeconds += preflightModel.addLine(line);
+
+    for ( uint8_t x = 0; x < 3; x++ )
+        end[x] = preflightModel.getPosition(x);
+
+    //Where the job starts from isn't known. An axis is known once a move sets it in absolute coordinates, and forgotten again when
+    //the work coordinates change under it or the machine moves it somewhere of its own (G28, G30, G53).
+    uint8_t startAxes = i_pfKnownAxes;
+    if ( coordinatesChanged )
+        i_pfKnownAxes = 0;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        if ( !(seen & (1UL << ('X' - 'A' + x))) )
+            continue;
+
+        if ( nonModal )
+            i_pfKnownAxes &= ~(1 << x);
+        else if ( moves && !b_pfIncremental )
+            i_pfKnownAxes |= 1 << x;
+    }
+
+    if ( moves && active <= 3 )
+    {
+        includePoint(end, i_pfKnownAxes);
+        if ( active >= 2 )
+            includeArc(start, end, words, seen, active == 2, startAxes & i_pfKnownAxes);
+    }
+}
+
+//Adds raw bytes of the job to the scan, lines may be split across calls.
+void preflightData( const uint8_t *data, size_t length )
+{
+    i_pfCRC = crc32Update(i_pfCRC, data, length);
+    i_pfBytes += length;
+
+    for ( size_t x = 0; x < length; x++ )
+    {
+        char c = static_cast<char>(data[x]);
+        if ( c == CHAR_NEWLINE )
+        {
+            c_pfLine[i_pfLineLength] = CHAR_NULL;
+            preflightLine(c_pfLine);
+            i_pfLineLength = 0;
+            b_pfLineOverflow = false;
+        }
+        else if ( i_pfLineLength < PF_LINE_MAX - 1 )
+            c_pfLine[i_pfLineLength++] = c;
+        else
+            b_pfLineOverflow = true;
+    }
+}
+
+//What the report depends on besides the job itself: the travel and work offset the limits are checked against (and whether the offset is known),
+//and the planner settings.
+String preflightSettingsKey()
+{
+    String key;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        key += String(soft_limit[x]) + ',' + String(getGrblAxisSetting(GRBL_SETTING::MAX_TRAVEL_X, x, 0), 3) + ',' + String(grblStatus.f_wco[x], 3) + ','
+               + String(getGrblAxisSetting(GRBL_SETTING::MAX_RATE_X, x, 0), 0) + ',' + String(getGrblAxisSetting(GRBL_SETTING::ACCEL_X, x, default_acceleration), 0) + ';';
+    }
+    return key + String(getGrblSetting(GRBL_SETTING::JUNCTION_DEVIATION, 0), 3) + (grblStatus.i_updateMillis ? PSTR(";wco") : PSTR(""));
+}
+
+uint32_t preflightKey()
+{
+    String settings = preflightSettingsKey();
+    return ~crc32Update(i_pfCRC, reinterpret_cast<const uint8_t *>(settings.c_str()), settings.length());
+}
+
+String preflightCachePath( uint32_t key )
+{
+    return file_PreflightCache + String(key % PF_CACHE_SLOTS);
+}
+
+String hexKey( uint32_t key )
+{
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", key);
+    return String(hex);
+}
+
+//Soft limit check. GRBL keeps machine positions between -travel and 0 once homed, the work envelope is moved there by the work offset.
+//Until GRBL has reported the work offset, only the size of the envelope can be checked.
+String preflightLimits()
+{
+    String result;
+    bool checked = false, offsetKnown = grblStatus.i_updateMillis != 0;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        float travel = soft_limit[x] ? soft_limit[x] : (b_grblSettingsValid ? getGrblAxisSetting(GRBL_SETTING::MAX_TRAVEL_X, x, 0) : 0);
+        if ( travel <= 0 || !(i_pfEnvelopeAxes & (1 << x)) )
+            continue;
+
+        checked = true;
+        float low = f_pfMin[x] + grblStatus.f_wco[x], high = f_pfMax[x] + grblStatus.f_wco[x],
+              beyond = offsetKnown ? max(-travel - low, high) : high - low - travel;
+        if ( beyond > 0 )
+            result += String(result.length() ? PSTR(", ") : PSTR("")) + static_cast<char>('X' + x) + PSTR(" beyond by ") + String(beyond, 3) + PSTR(" mm");
+    }
+
+    if ( !checked )
+        return PSTR("not checked (no travel known)");
+
+    if ( !result.length() )
+        result = PSTR("ok");
+
+    return offsetKnown ? result : result + PSTR(" (size only, no work offset from GRBL yet)");
+}
+
+String formatDuration( uint32_t seconds )
+{
+    char text[16];
+    snprintf(text, sizeof(text), "%u:%02u:%02u", seconds / 3600, (seconds / 60) % 60, seconds % 60);
+    return String(text);
+}
+
+String preflightReport( uint32_t key )
+{
+    f_pfSeconds += preflightModel.flush();
+
+    String report = MSG_PREFLIGHT + hexKey(key) + PSTR(": ") + i_pfLines + PSTR(" lines, ") + i_pfBytes + PSTR(" bytes, about ")
+                    + formatDuration(static_cast<uint32_t>(f_pfSeconds + 0.5f)) + PSTR(" to run") + (b_pfEnded ? PSTR("") : PSTR(", no M2/M30 at the end")) + MSG_NLCR;
+
+    if ( i_pfEnvelopeAxes )
+    {
+        report += PSTR("Envelope");
+        for ( uint8_t x = 0; x < 3; x++ )
+        {
+            report += String(x ? PSTR(",") : PSTR("")) + ' ' + static_cast<char>('X' + x) + ' ';
+            if ( i_pfEnvelopeAxes & (1 << x) )
+                report += String(f_pfMin[x], 3) + PSTR(" to ") + String(f_pfMax[x], 3) + PSTR(" mm");
+            else
+                report += PSTR("not set by the job");
+        }
+        report += PSTR(", soft limits ") + preflightLimits() + MSG_NLCR;
+    }
+    else
+        report += PSTR("No positions set by the job.") + MSG_NLCR;
+
+    report += PSTR("Feed ") + (f_pfFeedMax > 0 ? String(f_pfFeedMin, 0) + PSTR(" to ") + String(f_pfFeedMax, 0) + PSTR(" mm/min") : String(PSTR("none")))
+              + PSTR(", spindle ") + (f_pfSpindleMax > 0 ? PSTR("S") + String(f_pfSpindleMin, 0) + PSTR(" to S") + String(f_pfSpindleMax, 0) : String(PSTR("no speed")))
+              + PSTR(", on ") + i_pfSpindleOn + PSTR(" off ") + i_pfSpindleOff + PSTR(", coolant on ") + i_pfCoolantOn + PSTR(" off ") + i_pfCoolantOff
+              + PSTR(", pauses ") + i_pfPauses + MSG_NLCR;
+
+    report += PSTR("Tool changes: ") + String(i_pfToolChanges);
+    for ( uint8_t x = 0; x < i_pfToolCount; x++ )
+        report += PSTR(" T") + String(pfTools[x]);
+    report += MSG_NLCR;
+
+    report += PSTR("Rejected lines: ") + String(i_pfRejects);
+    for ( uint8_t x = 0; x < min(i_pfRejects, static_cast<uint32_t>(PF_REJECTS_LISTED)); x++ )
+    {
+        const PreflightReject &reject = pfRejects[x];
+        report += String(x ? PSTR(", ") : PSTR(" (")) + PSTR("line ") + reject.i_line + PSTR(": ") + reject.reason + (*reject.word ? PSTR(" ") + String(reject.word) : String());
+    }
+    return report + (i_pfRejects ? PSTR(")") : PSTR("")) + MSG_NLCR;
+}
+
+//Returns the cached report for the key, or an empty String.
+String cachedPreflightReport( uint32_t key )
+{
+    File file = b_FSOpen ? SPIFFS.open(preflightCachePath(key), FILE_READ) : File();
+    if ( !file )
+        return String();
+
+    String report;
+    if ( file.readStringUntil(CHAR_NEWLINE) == hexKey(key) )
+        report = file.readString();
+    file.close();
+    return report;
+}
+
+void cachePreflightReport( uint32_t key, const String &report )
+{
+    if ( !b_FSOpen )
+        return;
+
+    File file = SPIFFS.open(preflightCachePath(key), FILE_WRITE);
+    if ( !file )
+        return;
+
+    file.print(hexKey(key) + CHAR_NEWLINE + report);
+    file.close();
+}
+
+//Ends the scan, and reports on it. Also keeps the report, so that the same job doesn't have to be parsed again.
+void finishPreflight()
+{
+    if ( i_pfLineLength ) //no newline after the last line
+    {
+        c_pfLine[i_pfLineLength] = CHAR_NULL;
+        preflightLine(c_pfLine);
+        i_pfLineLength = 0;
+    }
+
+    uint32_t key = preflightKey();
+    String report = preflightReport(key);
+    cachePreflightReport(key, report);
+    printMessageToHost(report);
+}
+
+bool preflightAllowed()
+{
+    if ( b_preflightActive || b_framedMode || i_grblState != GRBL_STATE::IDLE )
+    {
+        printMessageToHost(PSTR("A pre-flight needs GRBL to be idle, in plain text mode, with no other pre-flight running.") + MSG_NLCR);
+        return false;
+    }
+    return true;
+}
+
+//Starts analyzing the lines sent by the host, instead of sending them to GRBL.
+void beginPreflight()
+{
+    if ( !preflightAllowed() )
+        return;
+
+    resetPreflight();
+    b_preflightActive = true;
+    printMessageToHost(MSG_PREFLIGHT + PSTR("started, nothing is sent to GRBL until /PFE.") + MSG_NLCR);
+}
+
+void endPreflight()
+{
+    if ( !b_preflightActive )
+    {
+        printMessageToHost(MSG_PREFLIGHT + PSTR("is not running.") + MSG_NLCR);
+        return;
+    }
+
+    b_preflightActive = false;
+    finishPreflight();
+}
+
+//Takes the place of forwardToGrbl() while a pre-flight runs. Every line is answered as GRBL would, realtime commands still go to GRBL.
+void preflightStream( const String &data )
+{
+    for ( uint16_t x = 0; x < data.length() && b_preflightActive; x++ )
+    {
+        char c = data[x];
+        if ( isGrblRealtime(c) )
+        {
+            forwardToGrbl(String(c));
+            continue;
+        }
+
+        if ( c == PF_LOCAL_COMMAND && !i_pfLineLength ) //such as the /PFE that ends it, sent along with the last lines
+        {
+            int end = data.indexOf(CHAR_NEWLINE, x);
+            if ( end < 0 )
+                end = data.length();
+            handleLocalCommand(removeFromStr(data.substring(x + 1, end), {CHAR_CARRIAGE}));
+            if ( !b_preflightActive ) //ended, whatever came after it in the same chunk is handled as usual
+            {
+                if ( end + 1 < static_cast<int>(data.length()) )
+                    processHostCommand(data.substring(end + 1));
+                return;
+            }
+            x = end;
+            continue;
+        }
+
+        uint8_t byte = static_cast<uint8_t>(c);
+        preflightData(&byte, 1);
+        if ( c == CHAR_NEWLINE || c == CHAR_CARRIAGE ) //GRBL answers both
+            sendOkToHost();
+    }
+}
+
+//Analyzes a job stored in SPIFFS, or prints the report kept from the last time.
+void preflightFile( String path )
+{
+    if ( !preflightAllowed() )
+        return;
+
+    if ( !path.startsWith("/") ) //SPIFFS paths start with a /, PF=job.nc is taken for /job.nc
+        path = String('/') + path;
+
+    File file = b_FSOpen ? SPIFFS.open(path, FILE_READ) : File();
+    if ( !file )
+    {
+        printMessageToHost(PSTR("Could not open ") + path + MSG_NLCR);
+        return;
+    }
+
+    uint8_t block[PF_READ_BLOCK];
+    size_t length;
+    uint32_t start = millis();
+
+    resetPreflight();
+    while ( (length = file.read(block, sizeof(block))) > 0 ) //hashing alone is far quicker than parsing
+    {
+        i_pfCRC = crc32Update(i_pfCRC, block, length);
+        yield();
+    }
+
+    uint32_t key = preflightKey();
+    String report = cachedPreflightReport(key);
+    if ( report.length() )
+    {
+        file.close();
+        printMessageToHost(report + PSTR("(kept from an earlier scan, ") + String(millis() - start) + PSTR(" msec)") + MSG_NLCR);
+        return;
+    }
+
+    resetPreflight();
+    file.seek(0);
+    while ( (length = file.read(block, sizeof(block))) > 0 )
+    {
+        preflightData(block, length);
+        yield();
+    }
+    file.close();
+
+    finishPreflight();
+    printMessageToHost(MSG_PREFLIGHT + PSTR("took ") + String(millis() - start) + PSTR(" msec") + MSG_NLCR);
+}
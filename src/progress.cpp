@@ -0,0 +1,538 @@
+/*
+This file contains the job progress estimate. Once the host has announced a job with /JOB=<lines>, every line that is forwarded to GRBL
+is run through a kinematic model of GRBL's planner, and the "ok" replies coming back tell us how far along GRBL has gotten. Both together
+give the percent complete and the time remaining. Lines sent outside of a job (jogging, $X and the like) are not estimated.
+*/
+#include "globaldefs.h"
+
+#define PROGRESS_LINE_MAX 96 //GRBL itself only accepts 80 chars per line
+#define PROGRESS_LINE_HISTORY 64 //lines that may be in flight between the ESP-32 and GRBL at once, GRBL's RX buffer is only 128 bytes.
+#define PROGRESS_CALIBRATION_MIN 10.0f //seconds of estimated work before the estimate is corrected using the real elapsed time.
+#define DEFAULT_RAPID_RATE 1000.0f //mm/min, used until GRBL's settings are known
+#define DEFAULT_JUNCTION_DEVIATION 0.01f //mm
+#define MM_PER_INCH 25.4f
+
+const String &MSG_PROGRESS PROGMEM = PSTR("Job progress: "),
+             &MSG_NO_JOB PROGMEM = PSTR("No job running."),
+             &MSG_ETA PROGMEM = PSTR("% ETA "),
+             &MSG_SECONDS PROGMEM = PSTR(" sec"),
+             &MSG_PROGRESS_STATUS PROGMEM = PSTR("|PRG:");
+
+KinematicModel jobModel;
+
+char c_progressLine[PROGRESS_LINE_MAX];
+uint8_t i_progressLineLength;
+
+float f_lineEstimates[PROGRESS_LINE_HISTORY], //cumulative estimate at the end of each line in flight, indexed by line number
+      f_estimateSent, //total estimate of all finalized moves
+      f_estimateAcked; //estimate at the last line acknowledged by GRBL
+
+uint32_t i_linesSent,
+         i_linesBlank, //empty lines sent, such as the '\r' of a CRLF. GRBL answers them, but they aren't part of the job.
+         i_linesAcked,
+         i_jobLines, //total number of lines in the job, if the host told us (0 = unknown)
+         i_jobStartMillis;
+
+bool b_jobActive,
+     b_jobEnding; //the end of program (M2/M30) has been forwarded, and we are waiting on GRBL to catch up.
+
+//Reads a G-code number without allocating anything. Returns a pointer past the last character used, or the input if there was no number.
+const char *parseGcodeNumber( const char *c, float &value )
+{
+    const char *start = c;
+    bool negative = false;
+    if ( *c == '-' || *c == '+' )
+    {
+        negative = (*c == '-');
+        c++;
+    }
+
+    float result = 0, scale = 1;
+    bool digits = false, fraction = false;
+    for ( ; ; c++ )
+    {
+        if ( *c >= '0' && *c <= '9' )
+        {
+            digits = true;
+            if ( fraction )
+            {
+                scale *= 0.1f;
+                result += (*c - '0') * scale;
+            }
+            else
+                result = result * 10 + (*c - '0');
+        }
+        else if ( *c == '.' && !fraction )
+            fraction = true;
+        else
+            break;
+    }
+
+    if ( !digits )
+        return start;
+
+    value = negative ? -result : result;
+    return c;
+}
+
+void KinematicModel::reset()
+{
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        f_pos[x] = 0;
+        f_heldExitDir[x] = 0;
+    }
+
+    f_feed = 0;
+    i_motion = 0;
+    i_plane = 17;
+    b_absolute = true;
+    b_inches = false;
+    b_held = false;
+    b_programEnd = false;
+    refreshLimits();
+}
+
+//Copies the machine limits out of the GRBL settings mirror, so that each line doesn't have to look them up again.
+void KinematicModel::refreshLimits()
+{
+    i_limitsRevision = i_grblSettingsRevision;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        f_maxRate[x] = b_grblSettingsValid ? getGrblAxisSetting(GRBL_SETTING::MAX_RATE_X, x, DEFAULT_RAPID_RATE) : DEFAULT_RAPID_RATE;
+        f_accel[x] = b_grblSettingsValid ? getGrblAxisSetting(GRBL_SETTING::ACCEL_X, x, default_acceleration) : default_acceleration;
+        f_accel[x] = max(f_accel[x], 1.0f); //avoid dividing by zero if nothing sensible is configured
+    }
+    f_junctionDeviation = b_grblSettingsValid ? getGrblSetting(GRBL_SETTING::JUNCTION_DEVIATION, DEFAULT_JUNCTION_DEVIATION) : DEFAULT_JUNCTION_DEVIATION;
+}
+
+//Returns the lowest per-axis limit for a move in the given direction, in the same way GRBL's planner limits rates and accelerations.
+float KinematicModel::axisLimit( const float *limits, const float *dir )
+{
+    float limit = 0;
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        float component = fabsf(dir[x]);
+        if ( component < 1e-6f )
+            continue;
+
+        float axis = limits[x] / component;
+        if ( limit == 0 || axis < limit )
+            limit = axis;
+    }
+
+    return limit > 0 ? limit : limits[0];
+}
+
+//Time (sec) for the held move to go from the given entry speed to the exit speed. The exit speed is reduced if it can't be reached.
+float KinematicModel::moveTime( float entry, float &exit )
+{
+    float accel = f_heldAccel, length = f_heldLength, speed = f_heldSpeed;
+    entry = min(entry, speed);
+
+    float reachable = sqrtf(entry * entry + 2 * accel * length);
+    if ( exit > reachable )
+        exit = reachable;
+
+    float accelDist = (speed * speed - entry * entry) / (2 * accel),
+          decelDist = (speed * speed - exit * exit) / (2 * accel);
+
+    if ( accelDist + decelDist <= length ) //trapezoid, the move reaches its nominal speed
+        return (speed - entry) / accel + (speed - exit) / accel + (length - accelDist - decelDist) / speed;
+
+    float peak = sqrtf((2 * accel * length + entry * entry + exit * exit) * 0.5f); //triangle
+    if ( peak < entry ) //can't slow down in time, GRBL's backward pass would have lowered the entry speed
+        return (entry + exit) > 0 ? 2 * length / (entry + exit) : 0;
+
+    return (peak - entry) / accel + (peak - exit) / accel;
+}
+
+//Finalizes the previously held move (now that the junction with the new move is known), then holds the new move in its place.
+float KinematicModel::holdMove( const float *entryDir, const float *exitDir, float length, float speed, float accel )
+{
+    float time = 0, entry = 0;
+    if ( b_held )
+    {
+        float cosTheta = -(f_heldExitDir[0] * entryDir[0] + f_heldExitDir[1] * entryDir[1] + f_heldExitDir[2] * entryDir[2]),
+              junction = min(f_heldSpeed, speed);
+
+        if ( cosTheta > 0.999999f ) //full reversal
+            junction = 0;
+        else if ( cosTheta > -0.999999f ) //straight lines keep the full speed
+        {
+            float sinThetaHalf = sqrtf(0.5f * (1.0f - cosTheta));
+            junction = min(junction, sqrtf(min(f_heldAccel, accel) * f_junctionDeviation * sinThetaHalf / (1.0f - sinThetaHalf)));
+        }
+
+        time = moveTime(f_heldEntry, junction);
+        entry = junction;
+    }
+
+    b_held = true;
+    f_heldLength = length;
+    f_heldSpeed = speed;
+    f_heldAccel = accel;
+    f_heldEntry = entry;
+    for ( uint8_t x = 0; x < 3; x++ )
+        f_heldExitDir[x] = exitDir[x];
+
+    return time;
+}
+
+float KinematicModel::flush()
+{
+    if ( !b_held )
+        return 0;
+
+    float exit = 0;
+    b_held = false;
+    return moveTime(f_heldEntry, exit);
+}
+
+float KinematicModel::pendingTime()
+{
+    if ( !b_held )
+        return 0;
+
+    float exit = 0;
+    return moveTime(f_heldEntry, exit);
+}
+
+float KinematicModel::addLine( const char *line )
+{
+    float words[26];
+    uint32_t seen = 0; //bit per word letter that appeared on this line
+    int8_t motion = -1;
+    bool dwell = false, nonModal = false;
+
+    b_programEnd = false;
+    if ( i_limitsRevision != i_grblSettingsRevision )
+        refreshLimits();
+
+    for ( const char *c = line; *c; )
+    {
+        char letter = toupper(*c);
+        if ( letter == '(' ) //comment, skip to its end
+        {
+            while ( *c && *c != ')' )
+                c++;
+            continue;
+        }
+        if ( letter == ';' )
+            break;
+        if ( letter < 'A' || letter > 'Z' )
+        {
+            c++;
+            continue;
+        }
+
+        float value;
+        const char *next = parseGcodeNumber(c + 1, value);
+        if ( next == c + 1 )
+        {
+            c++;
+            continue;
+        }
+        c = next;
+
+        if ( letter == 'G' )
+        {
+            switch ( static_cast<uint16_t>(value * 10 + 0.5f) )
+            {
+                case 0: motion = 0; break;
+                case 10: motion = 1; break;
+                case 20: motion = 2; break;
+                case 30: motion = 3; break;
+                case 40: dwell = true; break;
+                case 170: i_plane = 17; break;
+                case 180: i_plane = 18; break;
+                case 190: i_plane = 19; break;
+                case 200: b_inches = true; break;
+                case 210: b_inches = false; break;
+                case 900: b_absolute = true; break;
+                case 910: b_absolute = false; break;
+                case 100: case 280: case 300: case 530: case 920: nonModal = true; break; //axis words don't describe a normal move here (G53 is in machine coordinates)
+                default: break;
+            }
+        }
+        else if ( letter == 'M' )
+        {
+            if ( value == 2 || value == 30 )
+                b_programEnd = true;
+        }
+        else
+        {
+            words[letter - 'A'] = value;
+            seen |= 1UL << (letter - 'A');
+        }
+    }
+
+    float scale = b_inches ? MM_PER_INCH : 1.0f;
+    if ( seen & (1UL << ('F' - 'A')) )
+        f_feed = words['F' - 'A'] * scale;
+
+    if ( motion >= 0 )
+        i_motion = motion;
+
+    if ( dwell ) //the planner empties before a dwell
+    {
+        float time = flush();
+        if ( seen & (1UL << ('P' - 'A')) )
+            time += words['P' - 'A'];
+        return time;
+    }
+
+    const uint32_t axisWords = (1UL << ('X' - 'A')) | (1UL << ('Y' - 'A')) | (1UL << ('Z' - 'A'));
+    if ( nonModal || !(seen & axisWords) )
+        return 0;
+
+    float target[3], delta[3];
+    for ( uint8_t x = 0; x < 3; x++ )
+    {
+        target[x] = f_pos[x];
+        if ( seen & (1UL << ('X' - 'A' + x)) )
+            target[x] = (b_absolute ? 0 : f_pos[x]) + words['X' - 'A' + x] * scale;
+
+        delta[x] = target[x] - f_pos[x];
+    }
+
+    float time = 0;
+    if ( i_motion <= 1 ) //linear move
+    {
+        float length = sqrtf(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
+        if ( length > 1e-6f )
+        {
+            float dir[3] = { delta[0] / length, delta[1] / length, delta[2] / length },
+                  rate = axisLimit(f_maxRate, dir),
+                  speed = (i_motion == 0 ? rate : min(f_feed, rate)) / 60.0f;
+
+            if ( speed > 0 ) //G1 without a feed rate is rejected by GRBL
+                time = holdMove(dir, dir, length, speed, axisLimit(f_accel, dir));
+        }
+    }
+    else //arc, in the selected plane
+    {
+        uint8_t a0 = 0, a1 = 1, a2 = 2; //G17
+        if ( i_plane == 18 )
+        {
+            a0 = 2; a1 = 0; a2 = 1;
+        }
+        else if ( i_plane == 19 )
+        {
+            a0 = 1; a1 = 2; a2 = 0;
+        }
+
+        float offset[3] = { 0, 0, 0 };
+        if ( seen & (1UL << ('R' - 'A')) ) //radius format, find the center the same way GRBL does
+        {
+            float radius = words['R' - 'A'] * scale,
+                  chord = sqrtf(delta[a0] * delta[a0] + delta[a1] * delta[a1]);
+
+            if ( chord < 1e-6f )
+            {
+                f_pos[0] = target[0]; f_pos[1] = target[1]; f_pos[2] = target[2];
+                return 0;
+            }
+
+            float h = 4 * radius * radius - chord * chord;
+            h = -sqrtf(h > 0 ? h : 0) / chord;
+            if ( i_motion == 3 )
+                h = -h;
+            if ( radius < 0 )
+                h = -h;
+
+            offset[a0] = 0.5f * (delta[a0] - delta[a1] * h);
+            offset[a1] = 0.5f * (delta[a1] + delta[a0] * h);
+        }
+        else
+        {
+            for ( uint8_t x = 0; x < 3; x++ )
+            {
+                if ( seen & (1UL << ('I' - 'A' + x)) )
+                    offset[x] = words['I' - 'A' + x] * scale;
+            }
+        }
+
+        float start0 = -offset[a0], start1 = -offset[a1], //vectors from the center to the start and end points
+              end0 = delta[a0] - offset[a0], end1 = delta[a1] - offset[a1],
+              radius = sqrtf(start0 * start0 + start1 * start1),
+              angle = atan2f(start0 * end1 - start1 * end0, start0 * end0 + start1 * end1);
+
+        if ( i_motion == 2 ) //clockwise
+        {
+            if ( angle >= -1e-6f )
+                angle -= 2 * PI;
+        }
+        else if ( angle <= 1e-6f )
+            angle += 2 * PI;
+
+        float arcLength = fabsf(angle) * radius,
+              length = sqrtf(arcLength * arcLength + delta[a2] * delta[a2]);
+
+        if ( length > 1e-6f && radius > 1e-6f )
+        {
+            float sign = (i_motion == 2 ? -1.0f : 1.0f), planar = arcLength / length / radius,
+                  entryDir[3], exitDir[3];
+
+            entryDir[a0] = -start1 * sign * planar;
+            entryDir[a1] = start0 * sign * planar;
+            exitDir[a0] = -end1 * sign * planar;
+            exitDir[a1] = end0 * sign * planar;
+            entryDir[a2] = exitDir[a2] = delta[a2] / length;
+
+            float accel = axisLimit(f_accel, entryDir),
+                  speed = min(f_feed, axisLimit(f_maxRate, entryDir)) / 60.0f;
+
+            speed = min(speed, sqrtf(accel * radius)); //centripetal limit between GRBL's arc segments
+            if ( speed > 0 )
+                time = holdMove(entryDir, exitDir, length, speed, accel);
+        }
+    }
+
+    for ( uint8_t x = 0; x < 3; x++ )
+        f_pos[x] = target[x];
+
+    return time;
+}
+
+//Discards the current job estimate, usually because GRBL was reset.
+void resetProgress()
+{
+    jobModel.reset();
+    i_progressLineLength = 0;
+    f_estimateSent = 0;
+    f_estimateAcked = 0;
+    i_linesSent = 0;
+    i_linesBlank = 0;
+    i_linesAcked = 0;
+    i_jobLines = 0;
+    b_jobActive = false;
+    b_jobEnding = false;
+}
+
+//Starts a new job estimate. If the host knows how many lines the job has, the percentage can be reported as well.
+void startJob( uint32_t lines )
+{
+    resetProgress();
+    i_jobLines = lines;
+    b_jobActive = true;
+    i_jobStartMillis = millis();
+}
+
+//Called for each complete line that has been forwarded to GRBL.
+void progressLineForwarded()
+{
+    bool blank = !i_progressLineLength;
+    c_progressLine[i_progressLineLength] = CHAR_NULL;
+    i_progressLineLength = 0;
+
+    if ( !b_jobActive ) //only jobs announced by the host are estimated
+        return;
+
+    if ( blank ) //still answered by GRBL, so it keeps its place in the line history
+        i_linesBlank++;
+
+    f_estimateSent += jobModel.addLine(c_progressLine);
+    if ( jobModel.endOfProgram() )
+    {
+        f_estimateSent += jobModel.flush();
+        b_jobEnding = true;
+    }
+
+    f_lineEstimates[i_linesSent % PROGRESS_LINE_HISTORY] = f_estimateSent + jobModel.pendingTime();
+    i_linesSent++;
+}
+
+//Looks at everything that is forwarded to GRBL, one char at a time, so that partial lines are handled correctly.
+void trackProgress( const String &data )
+{
+    for ( uint16_t x = 0; x < data.length(); x++ )
+    {
+        char c = data[x];
+        if ( c == 0x18 ) //soft reset, GRBL discards everything
+            resetProgress();
+
+        if ( isGrblRealtime(c) )
+            continue; //realtime commands are not part of any line
+        else if ( c == CHAR_NEWLINE || c == CHAR_CARRIAGE ) //each one ends a line as far as GRBL is concerned
+            progressLineForwarded();
+        else if ( i_progressLineLength < PROGRESS_LINE_MAX - 1 )
+            c_progressLine[i_progressLineLength++] = c;
+    }
+}
+
+//The optimizer joined this many of the host's lines into others, so the job is that much shorter as far as GRBL is concerned.
+void progressLinesMerged( uint32_t lines )
+{
+    if ( i_jobLines > lines )
+        i_jobLines -= lines;
+}
+
+//Called for each "ok" or "error:" reply, which means GRBL has taken the oldest line in flight.
+void progressLineAcknowledged()
+{
+    if ( i_linesAcked >= i_linesSent )
+        return; //not one of ours
+
+    if ( i_linesSent - i_linesAcked <= PROGRESS_LINE_HISTORY )
+        f_estimateAcked = f_lineEstimates[i_linesAcked % PROGRESS_LINE_HISTORY];
+
+    i_linesAcked++;
+
+    if ( b_jobEnding && i_linesAcked == i_linesSent ) //GRBL has the whole program now
+        b_jobActive = false;
+}
+
+//Estimated time (sec) of work that is still ahead of GRBL, corrected by how fast the job has actually been moving so far.
+float remainingSeconds( float &percent )
+{
+    float sent = f_estimateSent + jobModel.pendingTime(),
+          remaining = sent - f_estimateAcked;
+
+    uint32_t jobLinesSent = i_linesSent - i_linesBlank;
+    percent = -1;
+    if ( i_jobLines && jobLinesSent )
+    {
+        if ( i_jobLines > jobLinesSent )
+            remaining += (i_jobLines - jobLinesSent) * (sent / jobLinesSent);
+
+        if ( f_estimateAcked + remaining > 0 )
+            percent = 100.0f * f_estimateAcked / (f_estimateAcked + remaining);
+    }
+
+    if ( f_estimateAcked > PROGRESS_CALIBRATION_MIN )
+    {
+        float ratio = (millis() - i_jobStartMillis) / 1000.0f / f_estimateAcked;
+        remaining *= constrain(ratio, 0.5f, 2.0f);
+    }
+
+    return remaining > 0 ? remaining : 0;
+}
+
+void printProgress()
+{
+    if ( !b_jobActive )
+    {
+        printMessageToHost(MSG_NO_JOB + MSG_NLCR);
+        return;
+    }
+
+    float percent, remaining = remainingSeconds(percent);
+    printMessageToHost(MSG_PROGRESS + (percent >= 0 ? String(percent, 1) : String('?')) + MSG_ETA + String(static_cast<uint32_t>(remaining)) + MSG_SECONDS
+                       + PSTR(" (") + i_linesAcked + '/' + i_linesSent + '/' + i_jobLines + PSTR(" lines)") + MSG_NLCR);
+}
+
+//Adds a "|PRG:percent,eta" field to a GRBL status report, as long as a job of known length is running.
+//Off by default (PRS), since senders that parse the standard fields may not expect it.
+String appendProgressToStatus( const String &msg )
+{
+    int end = msg.lastIndexOf('>');
+    if ( !b_progressInStatus || !b_jobActive || !i_jobLines || end < 0 )
+        return msg;
+
+    float percent, remaining = remainingSeconds(percent);
+    if ( percent < 0 )
+        return msg;
+
+    return msg.substring(0, end) + MSG_PROGRESS_STATUS + String(percent, 1) + ',' + static_cast<uint32_t>(remaining) + msg.substring(end);
+}
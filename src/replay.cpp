@@ -0,0 +1,214 @@
+/*
+This file contains the replay of a captured session (see capture.cpp). It is only built on a Linux host (CNC_NATIVE), where
+tools/replay.cpp runs it, never on the ESP-32.
+
+The firmware is started as usual, then the captured chunks are put back on the host and GRBL serial ports at the times they arrived,
+on the virtual clock, with loop() running once per msec in between and once after each chunk. Every output is muted, and compared
+byte by byte with what the capture says was sent, as both arrive. The report gives the first difference, with a short excerpt of
+both sides.
+*/
+#ifdef CNC_NATIVE
+#include "globaldefs.h"
+#include <native.h>
+
+#define REPLAY_MAX_AHEAD 8192 //output a replay may send before the capture shows it, before it is called a difference
+#define REPLAY_EXCERPT 24 //bytes shown on either side of a difference
+
+const String &MSG_MATCH PROGMEM = PSTR("match"),
+             &MSG_DIFFERS PROGMEM = PSTR("DIFFERS");
+
+//One kind of output. The bytes that haven't been compared yet are held on both sides.
+struct ReplayOutput
+{
+    uint32_t i_bytes, //sent so far
+             i_compared; //replayed bytes that matched the capture
+    vector<uint8_t> expected, //from the capture
+                    replayed;
+};
+
+const CAPTURE_RECORD replayOutputRecords[CAPTURE_OUTPUTS] = { CAPTURE_RECORD::GRBL_OUT, CAPTURE_RECORD::HOST_OUT, CAPTURE_RECORD::RELAYS_OUT };
+const char *const outputNames[CAPTURE_OUTPUTS] = { "GRBL", "host", "relays" };
+
+ReplayOutput replayOutputs[CAPTURE_OUTPUTS];
+String s_replayDifference; //the first one found, empty while everything matches
+uint8_t i_replayDifferingOutput = CAPTURE_OUTPUTS; //CAPTURE_OUTPUTS while everything matches
+
+//Shows the bytes from a difference on, with anything unprintable escaped.
+String replayExcerpt( const vector<uint8_t> &data, size_t start )
+{
+    size_t end = min(data.size(), start + REPLAY_EXCERPT);
+    return PSTR("\"") + String(escapeBytes(string(data.begin() + min(start, end), data.begin() + end))) + '"';
+}
+
+void setReplayDifference( uint8_t output, size_t x )
+{
+    ReplayOutput &out = replayOutputs[output];
+    i_replayDifferingOutput = output;
+    s_replayDifference = String(outputNames[output]) + PSTR(" output differs at byte ") + (out.i_compared + x) + PSTR(": captured ")
+                         + replayExcerpt(out.expected, x) + PSTR(", replayed ") + replayExcerpt(out.replayed, x);
+}
+
+//Compares as much of the replayed output as the capture has shown so far. Once a difference is found, nothing else is compared.
+void compareReplayOutput( uint8_t output )
+{
+    ReplayOutput &out = replayOutputs[output];
+    if ( s_replayDifference.length() )
+        return;
+
+    size_t common = min(out.expected.size(), out.replayed.size());
+    for ( size_t x = 0; x < common; x++ )
+    {
+        if ( out.expected[x] != out.replayed[x] )
+        {
+            setReplayDifference(output, x);
+            return;
+        }
+    }
+
+    out.expected.erase(out.expected.begin(), out.expected.begin() + common);
+    out.replayed.erase(out.replayed.begin(), out.replayed.begin() + common);
+    out.i_compared += common;
+
+    if ( out.replayed.size() > REPLAY_MAX_AHEAD ) //the capture isn't going to catch up
+        setReplayDifference(output, 0);
+}
+
+//Called by recordSessionOutput() with everything the replayed session sends out.
+void replayOutput( uint8_t output, const uint8_t *data, size_t length )
+{
+    ReplayOutput &out = replayOutputs[output];
+    out.i_bytes += length;
+    out.replayed.insert(out.replayed.end(), data, data + length);
+    compareReplayOutput(output);
+}
+
+//Adds a captured output record to what the replay is expected to send. Returns false for any other record.
+bool expectReplayOutput( CAPTURE_RECORD type, const uint8_t *data, size_t length )
+{
+    for ( uint8_t x = 0; x < CAPTURE_OUTPUTS; x++ )
+    {
+        if ( type == replayOutputRecords[x] )
+        {
+            replayOutputs[x].expected.insert(replayOutputs[x].expected.end(), data, data + length);
+            compareReplayOutput(x);
+            return true;
+        }
+    }
+    return false;
+}
+
+//Compares the replayed output with the capture's byte counts. Whatever is left on either side was never matched.
+bool finishReplayComparison( const uint8_t *counts, String &result )
+{
+    for ( uint8_t x = 0; x < CAPTURE_OUTPUTS && !s_replayDifference.length(); x++ )
+    {
+        compareReplayOutput(x);
+        if ( !s_replayDifference.length() && (replayOutputs[x].expected.size() || replayOutputs[x].replayed.size()) )
+            setReplayDifference(x, 0);
+    }
+
+    bool matched = true;
+    for ( uint8_t x = 0; x < CAPTURE_OUTPUTS; x++ )
+    {
+        const ReplayOutput &out = replayOutputs[x];
+        bool match = out.i_bytes == getUint32(counts + x * 4) && i_replayDifferingOutput != x;
+        result += String(x ? PSTR(", ") : PSTR("")) + outputNames[x] + ' ' + (match ? MSG_MATCH : MSG_DIFFERS) + PSTR(" (") + out.i_bytes
+                  + '/' + getUint32(counts + x * 4) + PSTR(" bytes)");
+        matched = matched && match;
+    }
+    if ( s_replayDifference.length() )
+        result += PSTR(". ") + s_replayDifference;
+    return matched;
+}
+
+bool readVarint( const vector<uint8_t> &capture, size_t &pos, uint32_t &value )
+{
+    value = 0;
+    for ( uint8_t shift = 0; shift < 35 && pos < capture.size(); shift += 7 )
+    {
+        uint8_t c = capture[pos++];
+        value |= static_cast<uint32_t>(c & 0x7F) << shift;
+        if ( !(c & 0x80) )
+            return true;
+    }
+    return false;
+}
+
+//Puts a captured chunk where loop() will read it, and lets loop() handle it.
+void replayInput( HardwareSerial &port, const uint8_t *data, size_t length )
+{
+    port.inject(string(reinterpret_cast<const char *>(data), length));
+    loop();
+}
+
+//Replays a whole capture, on firmware that has been through setup() and its first loop(). Returns true if every output matched.
+bool replayCapture( const vector<uint8_t> &capture, String &report )
+{
+    uint32_t records = 0, bytes = 0, startMillis = millis();
+    size_t pos = 0;
+    String result;
+    bool matched = false, ended = false;
+
+    b_replayActive = true;
+    b_outputMuted = true;
+    b_replayStopped = false;
+    uint32_t startMicros = micros();
+
+    while ( pos < capture.size() && !ended )
+    {
+        CAPTURE_RECORD type = static_cast<CAPTURE_RECORD>(capture[pos++]);
+        uint32_t dt, length;
+        if ( !readVarint(capture, pos, dt) || !readVarint(capture, pos, length) || length > CAPTURE_MAX_RECORD || pos + length > capture.size() )
+            break;
+
+        const uint8_t *data = capture.data() + pos;
+        pos += length;
+
+        if ( type == CAPTURE_RECORD::SNAPSHOT && length >= CAPTURE_SNAPSHOT_HEADER )
+        {
+            startMillis = getUint32(data);
+            nativeSetMillis(startMillis);
+            setRelayStates(data[4]);
+            i_grblState = static_cast<GRBL_STATE>(data[5]);
+            restoreSettingsSnapshot(String(string(reinterpret_cast<const char *>(data) + CAPTURE_SNAPSHOT_HEADER, length - CAPTURE_SNAPSHOT_HEADER)));
+            resetSession();
+            continue;
+        }
+
+        if ( type == CAPTURE_RECORD::END && length == CAPTURE_OUTPUTS * 4 )
+        {
+            matched = finishReplayComparison(data, result);
+            ended = true;
+            continue;
+        }
+
+        if ( !b_replayStopped )
+            nativeRunMillis(dt); //loop() runs far more often than once per msec, this is as close as the capture can show
+
+        if ( expectReplayOutput(type, data, length) || b_replayStopped ) //what the session sent out, the records that follow the stop included
+            continue;
+
+        if ( type == CAPTURE_RECORD::HOST )
+            replayInput(Serial, data, length);
+        else if ( type == CAPTURE_RECORD::GRBL )
+            replayInput(Serial2, data, length);
+        else
+            continue;
+
+        records++;
+        bytes += length;
+    }
+
+    uint32_t elapsedMicros = micros() - startMicros,
+             sessionMillis = millis() - startMillis;
+    b_replayActive = false;
+    b_outputMuted = false;
+
+    if ( !ended )
+        result = PSTR("capture is incomplete, nothing to compare");
+
+    report = PSTR("Replay: ") + String(records) + PSTR(" records, ") + bytes + PSTR(" bytes, ") + String(sessionMillis / 1000.0f, 1)
+             + PSTR(" sec of session in ") + (elapsedMicros / 1000) + PSTR(" msec. ") + result;
+    return matched;
+}
+#endif
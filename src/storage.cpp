@@ -2,12 +2,14 @@
 This file contains all of the necessary code for handling the savingh and reading of configuration settings from the flash file system on the ESP-32.
 */
 #include "globaldefs.h"
+#include <algorithm>
 
 
 //SPIFFS (flash file system) messages stored in program memory
 const String &err_Config PROGMEM = PSTR("Failed to load configuration."),
              &succ_Config PROGMEM = PSTR("Configuration saved."),
-             &succ_Config_loaded PROGMEM = PSTR("Configuration loaded.");
+             &succ_Config_loaded PROGMEM = PSTR("Configuration loaded."),
+             &MSG_SECRET_MASK PROGMEM = PSTR("********");
 
 void Device_Setting::setValue( const String &str )
 {
@@ -43,6 +45,14 @@ void Device_Setting::setValue( const String &str )
     }
 }
 
+String Device_Setting::displayValue()
+{
+    if ( b_secret && i_Type == OBJ_TYPE::TYPE_VAR_STRING && data.s_Ptr->length() )
+        return MSG_SECRET_MASK; //an empty one is shown as it is, so that the host can tell it isn't set
+
+    return getValue<String>();
+}
+
 void generateSettingsMap()
 {
     //Device specific settings
@@ -54,62 +64,105 @@ void generateSettingsMap()
     settingsMap.emplace(CMD_VACUUM_ROUTER, make_shared<Device_Setting>( &b_vacuumOnRouter, PSTR("Enable vacuum on router enable (bool)") ) ); 
     settingsMap.emplace(CMD_LIGHTS_ROUTER, make_shared<Device_Setting>( &b_lightsOnRouter, PSTR("Enable lights on router enable (bool)") ) ); 
     settingsMap.emplace(CMD_SIMULATION, make_shared<Device_Setting>( &b_simulationMode, PSTR("Enable simulation mode (bool)") ) );
+
+    settingsMap.emplace(CMD_ACCELERATION, make_shared<Device_Setting>( &default_acceleration, PSTR("Job estimate acceleration until GRBL settings are known (mm/sec^2)") ) );
+    settingsMap.emplace(CMD_PROGRESS_STATUS, make_shared<Device_Setting>( &b_progressInStatus, PSTR("Append job progress to status reports (bool)") ) );
+
+    settingsMap.emplace(CMD_STALL_TIMEOUT, make_shared<Device_Setting>( &stall_timeout, PSTR("No reply from GRBL before a stall is declared, 0 to disable (msec)") ) );
+    settingsMap.emplace(CMD_STALL_ACTIONS, make_shared<Device_Setting>( &stall_actions, PSTR("Stall actions: 1 notify, 2 flash lights, 4 feed hold (bits)") ) );
+    settingsMap.emplace(CMD_LATENCY_SLO, make_shared<Device_Setting>( &latency_slo, PSTR("Notify when p95 line latency is above this, 0 to disable (msec)") ) );
+
+    settingsMap.emplace(CMD_CAPTURE_LIMIT, make_shared<Device_Setting>( &capture_limit, PSTR("Largest session capture file (kB)") ) );
+
+    settingsMap.emplace(CMD_TELEMETRY, make_shared<Device_Setting>( &b_telemetryEnabled, PSTR("Enable the WebSocket telemetry server on port 81 (bool)") ) );
+    settingsMap.emplace(CMD_TELEMETRY_INTERVAL, make_shared<Device_Setting>( &telemetry_interval, PSTR("Shortest time between telemetry updates (msec)") ) );
+    settingsMap.emplace(CMD_WIFI_SSID, make_shared<Device_Setting>( &s_wifiSSID, PSTR("WiFi network name (String)") ) );
+    settingsMap.emplace(CMD_WIFI_PASSWORD, make_shared<Device_Setting>( &s_wifiPassword, PSTR("WiFi password (String)"), true ) );
+    settingsMap.emplace(CMD_WIFI_WITH_BLUETOOTH, make_shared<Device_Setting>( &b_wifiWithBluetooth, PSTR("Keep WiFi on while a Bluetooth host is connected, they share the radio (bool)") ) );
+
+    settingsMap.emplace(CMD_OPTIMIZER, make_shared<Device_Setting>( &b_optimizerEnabled, PSTR("Join nearly collinear G1 moves before they reach GRBL (bool)") ) );
+    settingsMap.emplace(CMD_OPTIMIZER_TOLERANCE, make_shared<Device_Setting>( &optimizer_tolerance, PSTR("Largest distance a joined move may stray from the original path (um)") ) );
+
+    settingsMap.emplace(CMD_SOFT_LIMIT_X, make_shared<Device_Setting>( &soft_limit[0], PSTR("X travel checked by pre-flight, 0 to use GRBL's $130 (mm)") ) );
+    settingsMap.emplace(CMD_SOFT_LIMIT_Y, make_shared<Device_Setting>( &soft_limit[1], PSTR("Y travel checked by pre-flight, 0 to use GRBL's $131 (mm)") ) );
+    settingsMap.emplace(CMD_SOFT_LIMIT_Z, make_shared<Device_Setting>( &soft_limit[2], PSTR("Z travel checked by pre-flight, 0 to use GRBL's $132 (mm)") ) );
 }
 
 
-bool loadSettings()
+//Returns the settings as they are stored, one "ID=value" per line. Masked, secrets are left out of it, for anything that leaves the ESP-32.
+String settingsText( bool masked )
 {
-    if ( !b_FSOpen )
-        return false;
-
-    File settingsFile = SPIFFS.open(file_Configuration, FILE_READ);
-    if (!settingsFile)
-    {
-        printMessageToHost(err_Config + MSG_NLCR);
-        return false;
-    }
+    String text;
+    for ( settings_itr = settingsMap.begin(); settings_itr != settingsMap.end(); settings_itr++ )
+        text += settings_itr->first + CHAR_EQUALS + (masked ? settings_itr->second->displayValue() : settings_itr->second->getValue<String>()) + CHAR_NEWLINE;
 
-    generateSettingsMap();
+    return text;
+}
 
-    while(settingsFile.position() != settingsFile.size()) //Go through the entire settings file
+//Sets every setting found in text (one "ID=value" per line), anything unknown is skipped. So is a masked secret, the current one is kept,
+//and so is every setting named in keep.
+void applySettings( const String &text, const vector<String> &keep )
+{
+    int start = 0;
+    while ( start < static_cast<int>(text.length()) )
     {
-        String settingID = settingsFile.readStringUntil(CHAR_EQUALS),
-               settingValue = settingsFile.readStringUntil(CHAR_NEWLINE);
+        int end = text.indexOf(CHAR_NEWLINE, start);
+        if ( end < 0 )
+            end = text.length();
 
-        for ( settings_itr = settingsMap.begin(); settings_itr != settingsMap.end(); settings_itr++ )
+        int equals = text.indexOf(CHAR_EQUALS, start);
+        if ( equals > start && equals < end )
         {
-            if ( settings_itr->first == settingID ) //search for the specific setting string identifier
-                settings_itr->second.get()->setValue(settingValue);
+            String id = text.substring(start, equals);
+            settings_itr = settingsMap.find(id); //search for the specific setting string identifier
+            String value = text.substring(equals + 1, end);
+            if ( settings_itr != settingsMap.end() && !(settings_itr->second->isSecret() && value == MSG_SECRET_MASK)
+                 && std::find(keep.begin(), keep.end(), id) == keep.end() )
+                settings_itr->second->setValue(value);
         }
+        start = end + 1;
     }
+}
 
-    printMessageToHost(succ_Config_loaded + MSG_NLCR);
+//Reads a whole settings file. Prints nothing, so that it can be used by the background initialization.
+bool readSettingsFile( const String &path, String &text )
+{
+    File settingsFile = SPIFFS.open(path, FILE_READ);
+    if (!settingsFile)
+        return false;
+
+    text = settingsFile.readString();
     settingsFile.close();
     return true;
 }
 
+//Writes the current settings to a file, in the format that readSettingsFile() reads. Prints nothing.
+bool writeSettingsFile( const String &path )
+{
+    if ( SPIFFS.exists(path)) 
+        SPIFFS.remove(path); //remove if possible
+
+    File settingsFile = SPIFFS.open(path, FILE_WRITE);
+    if (!settingsFile)
+        return false;
+
+    settingsFile.print(settingsText());
+    settingsFile.close(); //close the file
+    return true;
+}
+
 bool saveSettings()
 {
     if ( !b_FSOpen )
         return false;
 
-    if ( SPIFFS.exists(file_Configuration)) 
-        SPIFFS.remove(file_Configuration); //remove if possible
-
-    File settingsFile = SPIFFS.open(file_Configuration, FILE_WRITE);
-    if (!settingsFile)
+    if ( !writeSettingsFile(file_Configuration) )
     {
         printMessageToHost(err_Config + MSG_NLCR);
         return false;
     }
 
-    for ( settings_itr = settingsMap.begin(); settings_itr != settingsMap.end(); settings_itr++ )
-    {
-        String settingValue = settings_itr->second.get()->getValue<String>();
-        settingsFile.print(settings_itr->first + CHAR_EQUALS + settingValue + CHAR_NEWLINE);
-    }
-
-    settingsFile.close(); //close the file
+    saveBootSnapshot();
     printMessageToHost(succ_Config + MSG_NLCR);
     return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,288 @@
+/*
+This file contains the machine state telemetry. Status reports from GRBL are parsed into a typed state, and a history of recent motion
+and buffer use is kept in RAM, so that a host that connects in the middle of a job can catch up with a single request.
+*/
+#include "globaldefs.h"
+
+#define HISTORY_FINE_SIZE 600 //samples at full rate (one per HISTORY_FINE_INTERVAL), covers the last minute
+#define HISTORY_FINE_INTERVAL 100 //msec
+#define HISTORY_COARSE_SIZE 360 //decimated samples (one per HISTORY_COARSE_INTERVAL), covers the last hour
+#define HISTORY_COARSE_INTERVAL 10000 //msec
+#define HISTORY_UNITS 100.0f //positions are stored in 0.01mm steps
+#define HISTORY_CHUNK 32 //samples per message when printing the history
+
+const String &GRBL_PINS PROGMEM = PSTR("XYZPDHRS"); //order of the bits in GRBL_Status::i_pins
+
+GRBL_Status grblStatus;
+
+//A single history entry, stored relative to the entry before it. 12 bytes each.
+struct HistorySample
+{
+	int16_t i_delta[3]; //position change since the previous sample (0.01mm)
+	uint16_t i_dt; //time since the previous sample (msec)
+	uint8_t i_state, //GRBL state letter
+			i_bufferBlocks; //free planner blocks
+	uint16_t i_feed; //feed rate
+};
+
+//Fixed size ring of delta encoded samples. When the ring is full, the oldest sample is folded into the base position.
+template <uint16_t SIZE>
+class HistoryRing
+{
+	public:
+	void push( const int32_t *pos, uint32_t now, uint8_t state, uint8_t blocks, uint16_t feed )
+	{
+		if ( !i_count ) //the first sample is stored as the base
+		{
+			for ( uint8_t x = 0; x < 3; x++ )
+				i_base[x] = i_last[x] = pos[x];
+			i_baseMillis = i_lastMillis = now;
+		}
+
+		if ( i_count == SIZE ) //drop the oldest sample, moving the base up to it
+		{
+			HistorySample &oldest = samples[i_head];
+			for ( uint8_t x = 0; x < 3; x++ )
+				i_base[x] += oldest.i_delta[x];
+			i_baseMillis += oldest.i_dt;
+			i_head = (i_head + 1) % SIZE;
+			i_count--;
+		}
+
+		HistorySample &sample = samples[(i_head + i_count) % SIZE];
+		for ( uint8_t x = 0; x < 3; x++ ) //anything that doesn't fit is carried over into the next sample
+		{
+			int32_t delta = constrain(pos[x] - i_last[x], (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+			sample.i_delta[x] = static_cast<int16_t>(delta);
+			i_last[x] += delta;
+		}
+
+		uint32_t dt = min(now - i_lastMillis, (uint32_t)UINT16_MAX);
+		sample.i_dt = static_cast<uint16_t>(dt);
+		i_lastMillis += dt;
+
+		sample.i_state = state;
+		sample.i_bufferBlocks = blocks;
+		sample.i_feed = feed;
+		i_count++;
+	}
+
+	uint32_t lastMillis(){ return i_lastMillis; }
+	uint16_t count(){ return i_count; }
+
+	//Prints the ring as a single [HIST:...] message. Zero deltas are left empty to keep the response small.
+	void print( char tier )
+	{
+		if ( !i_count )
+			return;
+
+		String out = PSTR("[HIST:") + String(tier) + ':' + i_count + ':' + (millis() - i_baseMillis) + ':' + i_base[0] + ',' + i_base[1] + ',' + i_base[2] + ':';
+		for ( uint16_t x = 0; x < i_count; x++ )
+		{
+			const HistorySample &sample = samples[(i_head + x) % SIZE];
+			out += sample.i_dt;
+			for ( uint8_t y = 0; y < 3; y++ )
+			{
+				out += ',';
+				if ( sample.i_delta[y] )
+					out += sample.i_delta[y];
+			}
+			out += ',';
+			out += static_cast<char>(sample.i_state);
+			out += ',';
+			out += sample.i_bufferBlocks;
+			out += ',';
+			out += sample.i_feed;
+			out += ';';
+
+			if ( (x + 1) % HISTORY_CHUNK == 0 ) //don't build the whole response in RAM at once
+			{
+				printMessageToHost(out);
+				out.clear();
+			}
+		}
+
+		printMessageToHost(out + ']' + MSG_NLCR);
+	}
+
+	private:
+	HistorySample samples[SIZE];
+	uint16_t i_head,
+			 i_count;
+	int32_t i_base[3], //absolute position before the oldest sample (0.01mm)
+			i_last[3]; //absolute position after the newest sample (0.01mm)
+	uint32_t i_baseMillis,
+			 i_lastMillis;
+};
+
+HistoryRing<HISTORY_FINE_SIZE> historyFine;
+HistoryRing<HISTORY_COARSE_SIZE> historyCoarse;
+
+//Everything parseStatusReport() keeps, so that it can be put back after the benchmarks have fed it made up status reports.
+struct TelemetrySnapshot
+{
+	GRBL_Status status;
+	HistoryRing<HISTORY_FINE_SIZE> fine;
+	HistoryRing<HISTORY_COARSE_SIZE> coarse;
+};
+
+//Reads up to three comma separated numbers from a status field. Returns how many were found.
+uint8_t parseStatusValues( const char *c, float *values, uint8_t maxValues )
+{
+	uint8_t found = 0;
+	while ( found < maxValues )
+	{
+		const char *next = parseGcodeNumber(c, values[found]);
+		if ( next == c )
+			break;
+
+		found++;
+		if ( *next != ',' )
+			break;
+		c = next + 1;
+	}
+	return found;
+}
+
+//Compares the name of a status field (the part before ':') without copying it.
+bool statusFieldIs( const char *field, size_t length, const char *name )
+{
+	return strlen(name) == length && !strncmp(field, name, length);
+}
+
+//Stores the current state in the history rings, at full rate and decimated.
+void recordHistory()
+{
+	int32_t pos[3];
+	for ( uint8_t x = 0; x < 3; x++ )
+		pos[x] = static_cast<int32_t>(lroundf(grblStatus.f_mpos[x] * HISTORY_UNITS));
+
+	uint32_t now = grblStatus.i_updateMillis;
+	uint16_t feed = static_cast<uint16_t>(min(grblStatus.f_feed, (float)UINT16_MAX));
+	uint8_t state = static_cast<uint8_t>(grblStatus.state);
+
+	if ( !historyFine.count() || now - historyFine.lastMillis() >= HISTORY_FINE_INTERVAL )
+		historyFine.push(pos, now, state, grblStatus.i_bufferBlocks, feed);
+
+	if ( !historyCoarse.count() || now - historyCoarse.lastMillis() >= HISTORY_COARSE_INTERVAL )
+		historyCoarse.push(pos, now, state, grblStatus.i_bufferBlocks, feed);
+}
+
+//Parses a complete status report, such as <Run|MPos:1.000,2.000,0.000|Bf:15,128|FS:500,0|Ov:100,100,100|Pn:XZ>
+void parseStatusReport( const String &msg )
+{
+	const char *c = msg.c_str();
+	if ( *c != '<' )
+		return;
+
+	grblStatus.state = static_cast<GRBL_STATE>(c[1]);
+	grblStatus.i_pins = 0; //only reported while a pin is active
+	bool workPosition = false;
+
+	while ( (c = strchr(c, '|')) != nullptr )
+	{
+		c++;
+		const char *colon = strchr(c, ':');
+		if ( !colon )
+			break;
+
+		float values[3];
+		uint8_t found = parseStatusValues(colon + 1, values, 3);
+		size_t nameLength = colon - c;
+
+		if ( statusFieldIs(c, nameLength, "MPos") && found == 3 )
+		{
+			for ( uint8_t x = 0; x < 3; x++ )
+				grblStatus.f_mpos[x] = values[x];
+		}
+		else if ( statusFieldIs(c, nameLength, "WPos") && found == 3 )
+		{
+			for ( uint8_t x = 0; x < 3; x++ )
+				grblStatus.f_wpos[x] = values[x];
+			workPosition = true;
+		}
+		else if ( statusFieldIs(c, nameLength, "WCO") && found == 3 )
+		{
+			for ( uint8_t x = 0; x < 3; x++ )
+				grblStatus.f_wco[x] = values[x];
+		}
+		else if ( (statusFieldIs(c, nameLength, "FS") || statusFieldIs(c, nameLength, "F")) && found )
+		{
+			grblStatus.f_feed = values[0];
+			grblStatus.f_spindle = found > 1 ? values[1] : 0;
+		}
+		else if ( statusFieldIs(c, nameLength, "Ov") && found == 3 )
+		{
+			grblStatus.i_ovFeed = static_cast<uint8_t>(values[0]);
+			grblStatus.i_ovRapid = static_cast<uint8_t>(values[1]);
+			grblStatus.i_ovSpindle = static_cast<uint8_t>(values[2]);
+		}
+		else if ( statusFieldIs(c, nameLength, "Bf") && found == 2 )
+		{
+			grblStatus.i_bufferBlocks = static_cast<uint8_t>(values[0]);
+			grblStatus.i_bufferBytes = static_cast<uint16_t>(values[1]);
+		}
+		else if ( statusFieldIs(c, nameLength, "Pn") )
+		{
+			for ( const char *pin = colon + 1; *pin && *pin != '|' && *pin != '>'; pin++ )
+			{
+				int bit = GRBL_PINS.indexOf(*pin);
+				if ( bit >= 0 )
+					grblStatus.i_pins |= 1 << bit;
+			}
+		}
+	}
+
+	for ( uint8_t x = 0; x < 3; x++ ) //GRBL only reports one of the two positions ($10), work out the other one
+	{
+		if ( workPosition )
+			grblStatus.f_mpos[x] = grblStatus.f_wpos[x] + grblStatus.f_wco[x];
+		else
+			grblStatus.f_wpos[x] = grblStatus.f_mpos[x] - grblStatus.f_wco[x];
+	}
+
+	grblStatus.i_updateMillis = millis();
+	recordHistory();
+}
+
+void printStatus()
+{
+	String pins;
+	for ( uint8_t x = 0; x < GRBL_PINS.length(); x++ )
+	{
+		if ( grblStatus.i_pins & (1 << x) )
+			pins += GRBL_PINS[x];
+	}
+
+	printMessageToHost(PSTR("State: ") + String(static_cast<char>(grblStatus.state))
+					   + PSTR(" MPos: ") + String(grblStatus.f_mpos[0], 3) + ',' + String(grblStatus.f_mpos[1], 3) + ',' + String(grblStatus.f_mpos[2], 3)
+					   + PSTR(" WPos: ") + String(grblStatus.f_wpos[0], 3) + ',' + String(grblStatus.f_wpos[1], 3) + ',' + String(grblStatus.f_wpos[2], 3)
+					   + PSTR(" Feed: ") + String(grblStatus.f_feed, 0) + PSTR(" Spindle: ") + String(grblStatus.f_spindle, 0)
+					   + PSTR(" Ov: ") + grblStatus.i_ovFeed + ',' + grblStatus.i_ovRapid + ',' + grblStatus.i_ovSpindle
+					   + PSTR(" Pins: ") + pins + PSTR(" Buffer: ") + grblStatus.i_bufferBlocks + ',' + grblStatus.i_bufferBytes
+					   + PSTR(" Age: ") + (millis() - grblStatus.i_updateMillis) + PSTR(" msec") + MSG_NLCR);
+}
+
+//Sends the recent history as two messages, the full rate ring (F) followed by the decimated one (C).
+void printHistory()
+{
+	historyFine.print('F');
+	historyCoarse.print('C');
+}
+
+//The copy is about 12 kB, more than the loop task's stack, so it is made on the heap.
+shared_ptr<TelemetrySnapshot> saveTelemetry()
+{
+	shared_ptr<TelemetrySnapshot> snapshot = make_shared<TelemetrySnapshot>();
+	snapshot->status = grblStatus;
+	snapshot->fine = historyFine;
+	snapshot->coarse = historyCoarse;
+	return snapshot;
+}
+
+void restoreTelemetry( const TelemetrySnapshot &snapshot )
+{
+	grblStatus = snapshot.status;
+	historyFine = snapshot.fine;
+	historyCoarse = snapshot.coarse;
+}
@@ -0,0 +1,580 @@
+/*
+This file contains the WebSocket telemetry server, for watching the machine from a browser (or anything else) over WiFi.
+Off unless WS=1 and an SSID is set, and off while a Bluetooth host is connected unless WSBT=1. Listens on port 81, on any path.
+
+Updates are JSON text messages. The first one a client gets holds every field, after that only the fields that have changed are sent:
+    {"n":12,"s":"R","v":1,"l":1,"c":1,"x":10.000,"y":-2.500,"z":-1.000,"f":1200,"b":12}
+    n - update number, s - GRBL state, v/l/c - vacuum/lights/cooler, x/y/z - work position (mm), f - feed rate, b - free planner blocks
+A client that could not take an update in time (its socket was full) is sent every field again once it has caught up.
+
+Each update is encoded once and then written to every client without blocking. Updates go out at most once every WSINT msec and
+only when something has changed, and the work done per cycle is bounded. A client that stops reading is skipped, never waited for.
+test/native/test_websocket.cpp streams the same job with and without watchers on the host build: it takes exactly as long either
+way, and four watchers with an update every cycle add about 15 us of CPU time to each loop() there.
+
+What that leaves out is the radio. The ESP-32 has one for both WiFi and Bluetooth and shares it between them in time, so a
+WiFi connection costs a Bluetooth SPP host throughput and latency, however little the server itself sends. That has not been
+measured yet, which is why WiFi is kept off while a Bluetooth host is connected. To measure it, stream the same job from a
+Bluetooth host with WSBT=0 and with WSBT=1 and a watcher connected, and compare the job time and the /ACK latency percentiles.
+*/
+#include "globaldefs.h"
+#include <WiFi.h>
+#include <lwip/sockets.h>
+
+#ifndef WS_PORT
+#define WS_PORT 81
+#endif
+#define WS_MAX_CLIENTS 4
+#define WS_REQUEST_MAX 512 //longest handshake request we will accept
+#define WS_HANDSHAKE_TIMEOUT 2000 //msec
+#define WS_OUT_BUFFER 256 //bytes per client that are waiting to be written
+#define WS_READ_CHUNK 64 //bytes read from each client per cycle
+#define WS_CONTROL_MAX 125 //largest ping or close payload
+
+const String &WS_GUID PROGMEM = PSTR("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+
+enum class WS_OPCODE : uint8_t
+{
+	TEXT = 0x1,
+	CLOSE = 0x8,
+	PING = 0x9,
+	PONG = 0xA,
+};
+
+enum class WS_CLIENT_STATE : uint8_t
+{
+	FREE,
+	HANDSHAKE,
+	OPEN,
+	CLOSING, //close once everything has been written
+};
+
+//Everything that is sent to the watchers. Positions are kept in whole um, so that changes can be compared exactly.
+struct TelemetryState
+{
+	char state;
+	uint8_t relays; //bit 0 vacuum, 1 lights, 2 cooler
+	int32_t i_pos[3];
+	uint16_t i_feed;
+	uint8_t i_blocks;
+};
+
+struct WS_Client
+{
+	WiFiClient client;
+	WS_CLIENT_STATE state;
+	String s_request;
+	uint32_t i_connectMillis,
+			 i_lastUpdate; //number of the last update this client has, 0 if it needs every field
+
+	uint8_t out[WS_OUT_BUFFER];
+	uint16_t i_outLength;
+
+	//Incoming frame, parsed a byte at a time
+	uint8_t frameHeader[14],
+			i_headerLength,
+			control[WS_CONTROL_MAX];
+	uint32_t i_payloadLength,
+			 i_payloadPos;
+};
+
+bool b_telemetryEnabled,
+	 b_wifiWithBluetooth,
+	 b_telemetryStarted,
+	 b_wifiConnected;
+
+String s_wifiSSID,
+	   s_wifiPassword;
+
+uint32_t telemetry_interval,
+		 i_telemetryUpdate = 1, //0 is reserved for clients that need everything
+		 i_telemetryLastMillis,
+		 i_telemetrySent,
+		 i_telemetryBytes;
+
+WiFiServer telemetryServer(WS_PORT);
+WS_Client wsClients[WS_MAX_CLIENTS];
+TelemetryState lastTelemetry;
+
+uint32_t rotateLeft( uint32_t value, uint8_t bits ){ return (value << bits) | (value >> (32 - bits)); }
+
+//SHA-1, only needed for the handshake.
+void sha1( const uint8_t *data, size_t length, uint8_t *digest )
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	size_t total = ((length + 8) / 64 + 1) * 64; //padded to whole blocks, with room for the 0x80 byte and the bit count
+
+	for ( size_t offset = 0; offset < total; offset += 64 )
+	{
+		uint32_t w[80];
+		for ( uint8_t x = 0; x < 64; x++ )
+		{
+			size_t pos = offset + x;
+			uint8_t c = 0;
+			if ( pos < length )
+				c = data[pos];
+			else if ( pos == length )
+				c = 0x80;
+			else if ( pos >= total - 8 )
+				c = static_cast<uint8_t>((static_cast<uint64_t>(length) * 8) >> ((total - 1 - pos) * 8));
+
+			if ( x % 4 == 0 )
+				w[x / 4] = 0;
+			w[x / 4] |= static_cast<uint32_t>(c) << ((3 - x % 4) * 8);
+		}
+
+		for ( uint8_t x = 16; x < 80; x++ )
+			w[x] = rotateLeft(w[x - 3] ^ w[x - 8] ^ w[x - 14] ^ w[x - 16], 1);
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for ( uint8_t x = 0; x < 80; x++ )
+		{
+			uint32_t f, k;
+			if ( x < 20 )
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if ( x < 40 )
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if ( x < 60 )
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+
+			uint32_t temp = rotateLeft(a, 5) + f + e + k + w[x];
+			e = d;
+			d = c;
+			c = rotateLeft(b, 30);
+			b = a;
+			a = temp;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	for ( uint8_t x = 0; x < 20; x++ )
+		digest[x] = static_cast<uint8_t>(h[x / 4] >> ((3 - x % 4) * 8));
+}
+
+String base64Encode( const uint8_t *data, size_t length )
+{
+	static const char table[] PROGMEM = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	String out;
+	for ( size_t x = 0; x < length; x += 3 )
+	{
+		uint32_t group = data[x] << 16;
+		if ( x + 1 < length )
+			group |= data[x + 1] << 8;
+		if ( x + 2 < length )
+			group |= data[x + 2];
+
+		out += table[(group >> 18) & 0x3F];
+		out += table[(group >> 12) & 0x3F];
+		out += x + 1 < length ? table[(group >> 6) & 0x3F] : '=';
+		out += x + 2 < length ? table[group & 0x3F] : '=';
+	}
+	return out;
+}
+
+//Drops whatever the client was doing, and frees its slot.
+void closeClient( WS_Client &ws )
+{
+	ws.client.stop();
+	ws.state = WS_CLIENT_STATE::FREE;
+	ws.s_request = String();
+	ws.i_outLength = 0;
+}
+
+//Queues raw bytes for the client. Returns false (and queues nothing) if they don't fit.
+bool queueBytes( WS_Client &ws, const uint8_t *data, uint16_t length )
+{
+	if ( ws.i_outLength + length > WS_OUT_BUFFER )
+		return false;
+
+	memcpy(ws.out + ws.i_outLength, data, length);
+	ws.i_outLength += length;
+	return true;
+}
+
+//Queues a single unmasked frame. Returns false if it doesn't fit, a frame is never split.
+bool queueFrame( WS_Client &ws, WS_OPCODE opcode, const uint8_t *payload, uint16_t length )
+{
+	uint8_t header[4] = { static_cast<uint8_t>(0x80 | static_cast<uint8_t>(opcode)) };
+	uint8_t headerLength = 2;
+	if ( length < 126 )
+		header[1] = static_cast<uint8_t>(length);
+	else
+	{
+		header[1] = 126;
+		header[2] = static_cast<uint8_t>(length >> 8);
+		header[3] = static_cast<uint8_t>(length & 0xFF);
+		headerLength = 4;
+	}
+
+	if ( ws.i_outLength + headerLength + length > WS_OUT_BUFFER )
+		return false;
+
+	queueBytes(ws, header, headerLength);
+	queueBytes(ws, payload, length);
+	return true;
+}
+
+//Writes as much of the queued data as the socket will take right now.
+void flushClient( WS_Client &ws )
+{
+	if ( !ws.i_outLength )
+	{
+		if ( ws.state == WS_CLIENT_STATE::CLOSING )
+			closeClient(ws);
+		return;
+	}
+
+	int sent = send(ws.client.fd(), ws.out, ws.i_outLength, MSG_DONTWAIT);
+	if ( sent < 0 )
+	{
+		if ( errno != EWOULDBLOCK && errno != EAGAIN )
+			closeClient(ws);
+		return;
+	}
+
+	ws.i_outLength -= sent;
+	memmove(ws.out, ws.out + sent, ws.i_outLength);
+}
+
+//Answers the HTTP upgrade request once all of it has arrived.
+void handleHandshake( WS_Client &ws )
+{
+	if ( ws.s_request.indexOf(PSTR("\r\n\r\n")) < 0 )
+		return;
+
+	String request = ws.s_request;
+	request.toLowerCase(); //header names are case insensitive
+	int keyStart = request.indexOf(PSTR("sec-websocket-key:"));
+	String key;
+	if ( keyStart >= 0 )
+	{
+		keyStart += 18;
+		key = ws.s_request.substring(keyStart, ws.s_request.indexOf(CHAR_CARRIAGE, keyStart));
+		key.trim();
+	}
+
+	ws.s_request = String();
+
+	if ( !key.length() )
+	{
+		String response = PSTR("HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n");
+		queueBytes(ws, reinterpret_cast<const uint8_t *>(response.c_str()), response.length());
+		ws.state = WS_CLIENT_STATE::CLOSING;
+		return;
+	}
+
+	key += WS_GUID;
+	uint8_t digest[20];
+	sha1(reinterpret_cast<const uint8_t *>(key.c_str()), key.length(), digest);
+
+	String response = PSTR("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ")
+					  + base64Encode(digest, sizeof(digest)) + PSTR("\r\n\r\n");
+	queueBytes(ws, reinterpret_cast<const uint8_t *>(response.c_str()), response.length());
+	ws.state = WS_CLIENT_STATE::OPEN;
+	ws.i_lastUpdate = 0;
+	ws.i_headerLength = 0;
+}
+
+//A complete frame has arrived from the client. Only the control frames need an answer, anything else is ignored.
+void handleClientFrame( WS_Client &ws, uint8_t opcode )
+{
+	uint16_t length = min(ws.i_payloadLength, (uint32_t)WS_CONTROL_MAX);
+	if ( opcode == static_cast<uint8_t>(WS_OPCODE::PING) )
+		queueFrame(ws, WS_OPCODE::PONG, ws.control, length);
+	else if ( opcode == static_cast<uint8_t>(WS_OPCODE::CLOSE) )
+	{
+		queueFrame(ws, WS_OPCODE::CLOSE, ws.control, min(length, (uint16_t)2)); //echo the status code
+		ws.state = WS_CLIENT_STATE::CLOSING;
+	}
+}
+
+//Size of the header of the frame being received, as far as it is known yet.
+uint8_t frameHeaderSize( const WS_Client &ws )
+{
+	if ( ws.i_headerLength < 2 )
+		return 2;
+
+	uint8_t length = ws.frameHeader[1] & 0x7F;
+	return 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + (ws.frameHeader[1] & 0x80 ? 4 : 0);
+}
+
+//Runs the bytes from an open client through the frame parser, one byte at a time.
+void handleClientData( WS_Client &ws, const uint8_t *data, uint16_t length )
+{
+	for ( uint16_t x = 0; x < length && ws.state == WS_CLIENT_STATE::OPEN; x++ )
+	{
+		uint8_t headerSize = frameHeaderSize(ws);
+		if ( ws.i_headerLength < headerSize )
+		{
+			ws.frameHeader[ws.i_headerLength++] = data[x];
+			headerSize = frameHeaderSize(ws);
+			if ( ws.i_headerLength < headerSize )
+				continue;
+
+			uint8_t lengthBytes = headerSize - 2 - (ws.frameHeader[1] & 0x80 ? 4 : 0);
+			ws.i_payloadLength = ws.frameHeader[1] & 0x7F;
+			if ( lengthBytes )
+			{
+				ws.i_payloadLength = 0;
+				for ( uint8_t y = 0; y < min(lengthBytes, (uint8_t)4); y++ ) //nothing we would read is longer than that
+					ws.i_payloadLength |= static_cast<uint32_t>(ws.frameHeader[1 + lengthBytes - y]) << (y * 8);
+			}
+			ws.i_payloadPos = 0;
+		}
+		else
+		{
+			uint8_t value = data[x];
+			if ( ws.frameHeader[1] & 0x80 ) //client frames are masked
+				value ^= ws.frameHeader[headerSize - 4 + ws.i_payloadPos % 4];
+			if ( ws.i_payloadPos < WS_CONTROL_MAX )
+				ws.control[ws.i_payloadPos] = value;
+			ws.i_payloadPos++;
+		}
+
+		if ( ws.i_payloadPos == ws.i_payloadLength )
+		{
+			handleClientFrame(ws, ws.frameHeader[0] & 0x0F);
+			ws.i_headerLength = 0;
+		}
+	}
+}
+
+TelemetryState currentTelemetry()
+{
+	TelemetryState current;
+	current.state = static_cast<char>(i_grblState);
+	current.relays = relayStates();
+	for ( uint8_t x = 0; x < 3; x++ )
+		current.i_pos[x] = static_cast<int32_t>(lroundf(grblStatus.f_wpos[x] * 1000.0f));
+	current.i_feed = static_cast<uint16_t>(min(grblStatus.f_feed, (float)UINT16_MAX));
+	current.i_blocks = grblStatus.i_bufferBlocks;
+	return current;
+}
+
+//Encodes the fields of current that differ from previous, or all of them if previous is null.
+String encodeTelemetry( const TelemetryState &current, const TelemetryState *previous )
+{
+	static const char axes[] = "xyz",
+					  relays[] = "vlc";
+
+	String out = PSTR("{\"n\":") + String(i_telemetryUpdate);
+	if ( !previous || previous->state != current.state )
+		out += PSTR(",\"s\":\"") + String(current.state) + '"';
+
+	for ( uint8_t x = 0; x < 3; x++ )
+	{
+		if ( !previous || ((previous->relays ^ current.relays) & (1 << x)) )
+			out += String(PSTR(",\"")) + relays[x] + PSTR("\":") + ((current.relays >> x) & 1);
+	}
+
+	for ( uint8_t x = 0; x < 3; x++ )
+	{
+		if ( !previous || previous->i_pos[x] != current.i_pos[x] )
+			out += String(PSTR(",\"")) + axes[x] + PSTR("\":") + String(current.i_pos[x] / 1000.0f, 3);
+	}
+
+	if ( !previous || previous->i_feed != current.i_feed )
+		out += PSTR(",\"f\":") + String(current.i_feed);
+	if ( !previous || previous->i_blocks != current.i_blocks )
+		out += PSTR(",\"b\":") + String(current.i_blocks);
+
+	return out + '}';
+}
+
+bool telemetryChanged( const TelemetryState &a, const TelemetryState &b )
+{
+	return a.state != b.state || a.relays != b.relays || a.i_pos[0] != b.i_pos[0] || a.i_pos[1] != b.i_pos[1] || a.i_pos[2] != b.i_pos[2]
+		   || a.i_feed != b.i_feed || a.i_blocks != b.i_blocks;
+}
+
+//Sends the changes to every open client, encoding each kind of message at most once.
+void broadcastTelemetry()
+{
+	if ( millis() - i_telemetryLastMillis < telemetry_interval )
+		return;
+
+	i_telemetryLastMillis = millis();
+
+	TelemetryState current = currentTelemetry();
+	bool changed = telemetryChanged(current, lastTelemetry);
+	String delta, full;
+
+	if ( changed )
+	{
+		i_telemetryUpdate++;
+		delta = encodeTelemetry(current, &lastTelemetry);
+		lastTelemetry = current;
+	}
+
+	for ( uint8_t x = 0; x < WS_MAX_CLIENTS; x++ )
+	{
+		WS_Client &ws = wsClients[x];
+		if ( ws.state != WS_CLIENT_STATE::OPEN || ws.i_lastUpdate == i_telemetryUpdate )
+			continue;
+
+		const String *message = &delta;
+		if ( !changed || ws.i_lastUpdate != i_telemetryUpdate - 1 ) //new, or it missed something
+		{
+			if ( !full.length() )
+				full = encodeTelemetry(current, nullptr);
+			message = &full;
+		}
+
+		if ( queueFrame(ws, WS_OPCODE::TEXT, reinterpret_cast<const uint8_t *>(message->c_str()), message->length()) )
+		{
+			ws.i_lastUpdate = i_telemetryUpdate;
+			i_telemetrySent++;
+			i_telemetryBytes += message->length();
+		}
+		//otherwise it is still writing an earlier update, and will be sent everything once that is done
+	}
+}
+
+//Brings WiFi and the server up or down to match the settings.
+void startTelemetryServer()
+{
+	WiFi.mode(WIFI_STA);
+	WiFi.setAutoReconnect(true);
+	WiFi.begin(s_wifiSSID.c_str(), s_wifiPassword.c_str()); //returns straight away, the connection is made in the background
+	telemetryServer.begin();
+	telemetryServer.setNoDelay(true);
+	lastTelemetry = currentTelemetry();
+	b_telemetryStarted = true;
+}
+
+void stopTelemetryServer()
+{
+	for ( uint8_t x = 0; x < WS_MAX_CLIENTS; x++ )
+	{
+		if ( wsClients[x].state != WS_CLIENT_STATE::FREE )
+			closeClient(wsClients[x]);
+	}
+	telemetryServer.end();
+	WiFi.disconnect(true);
+	WiFi.mode(WIFI_OFF);
+	b_telemetryStarted = false;
+	b_wifiConnected = false;
+}
+
+//Called once per cycle. Accepts at most one client, reads a little from each, and writes whatever the sockets will take.
+void serviceTelemetryServer()
+{
+	bool wanted = b_telemetryEnabled && s_wifiSSID.length() && (b_wifiWithBluetooth || !bluetoothHostConnected());
+	if ( wanted != b_telemetryStarted )
+	{
+		if ( wanted )
+			startTelemetryServer();
+		else
+			stopTelemetryServer();
+	}
+
+	if ( !b_telemetryStarted )
+		return;
+
+	if ( (WiFi.status() == WL_CONNECTED) != b_wifiConnected )
+	{
+		b_wifiConnected = !b_wifiConnected;
+		if ( b_wifiConnected )
+			printMessageToHost(PSTR("[MSG:Telemetry at ws://") + WiFi.localIP().toString() + ':' + WS_PORT + PSTR("/]") + MSG_NLCR);
+	}
+
+	if ( telemetryServer.hasClient() )
+	{
+		WiFiClient client = telemetryServer.available();
+		for ( uint8_t x = 0; x < WS_MAX_CLIENTS; x++ )
+		{
+			if ( wsClients[x].state == WS_CLIENT_STATE::FREE )
+			{
+				wsClients[x].client = client;
+				wsClients[x].state = WS_CLIENT_STATE::HANDSHAKE;
+				wsClients[x].i_connectMillis = millis();
+				wsClients[x].i_outLength = 0;
+				client = WiFiClient();
+				break;
+			}
+		}
+		client.stop(); //no room, if it wasn't taken
+	}
+
+	for ( uint8_t x = 0; x < WS_MAX_CLIENTS; x++ )
+	{
+		WS_Client &ws = wsClients[x];
+		if ( ws.state == WS_CLIENT_STATE::FREE )
+			continue;
+
+		if ( !ws.client.connected() )
+		{
+			closeClient(ws);
+			continue;
+		}
+
+		uint8_t data[WS_READ_CHUNK];
+		int length = ws.client.available() ? ws.client.read(data, sizeof(data)) : 0;
+		if ( length > 0 )
+		{
+			if ( ws.state == WS_CLIENT_STATE::HANDSHAKE )
+			{
+				for ( int y = 0; y < length; y++ )
+					ws.s_request += static_cast<char>(data[y]);
+				handleHandshake(ws);
+			}
+			else
+				handleClientData(ws, data, length);
+		}
+
+		if ( ws.state == WS_CLIENT_STATE::HANDSHAKE && (ws.s_request.length() > WS_REQUEST_MAX || millis() - ws.i_connectMillis > WS_HANDSHAKE_TIMEOUT) )
+		{
+			closeClient(ws);
+			continue;
+		}
+	}
+
+	broadcastTelemetry();
+
+	for ( uint8_t x = 0; x < WS_MAX_CLIENTS; x++ )
+	{
+		if ( wsClients[x].state != WS_CLIENT_STATE::FREE )
+			flushClient(wsClients[x]);
+	}
+}
+
+void printTelemetryStatus()
+{
+	if ( !b_telemetryStarted )
+	{
+		if ( b_telemetryEnabled && s_wifiSSID.length() )
+			printMessageToHost(PSTR("Telemetry server is off while a Bluetooth host is connected (WSBT=1 keeps it on).") + MSG_NLCR);
+		else
+			printMessageToHost(PSTR("Telemetry server is off (WS=1 and an SSID turn it on).") + MSG_NLCR);
+		return;
+	}
+
+	uint8_t clients = 0;
+	for ( uint8_t x = 0; x < WS_MAX_CLIENTS; x++ )
+	{
+		if ( wsClients[x].state == WS_CLIENT_STATE::OPEN )
+			clients++;
+	}
+
+	printMessageToHost(PSTR("WiFi: ") + (b_wifiConnected ? WiFi.localIP().toString() : String(PSTR("connecting"))) + PSTR(", watchers: ") + String(clients)
+					   + PSTR(", updates: ") + i_telemetryUpdate + PSTR(", messages sent: ") + i_telemetrySent + PSTR(" (") + i_telemetryBytes + PSTR(" bytes)") + MSG_NLCR);
+}
@@ -0,0 +1,50 @@
+/*
+test_boot - the start up (src/boot.cpp), with the host busy before the settings file has been read. A setting it changes in the
+meantime is kept, status polls don't count as the first forward, and GRBL is not reset by the first loop().
+*/
+#include "testing.h"
+
+using namespace std;
+
+string hostOutput, grblInput;
+
+static void runMillis( uint32_t ms )
+{
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		nativeSetMillis(millis() + 1);
+		loop();
+		hostOutput += Serial.takeOutput();
+		grblInput += Serial2.takeOutput();
+	}
+}
+
+int main()
+{
+	File file = SPIFFS.open("/config.cfg", FILE_WRITE);
+	file.print("STALL=45000\nSTALLA=3\n");
+	file.close();
+
+	nativeSetMillis(1);
+	setup(); //the background task is only run once the host has been busy for a while
+	runMillis(5);
+	check(grblInput.find('\x18') == string::npos, "the first loop() doesn't reset GRBL");
+
+	Serial.inject("?");
+	runMillis(10);
+	Serial.inject("/STALL=2000\n");
+	runMillis(10);
+	Serial.inject("G1 X1\n");
+	runMillis(1);
+	uint32_t forwardMillis = millis();
+	runMillis(10);
+
+	nativeRunTasks();
+	runMillis(5);
+	check(stall_timeout == 2000, "the setting the host changed is kept");
+	check(stall_actions == 3, "the rest comes from the settings file");
+	check(i_firstForwardMillis == forwardMillis, "the status poll doesn't count as the first forward");
+	check(hostOutput.find("first forward " + to_string(forwardMillis) + " msec") != string::npos, "the first forward is reported");
+
+	return testResult();
+}
@@ -0,0 +1,173 @@
+/*
+test_frames - the framed host protocol (src/hostframe.cpp): CRCs, sequence numbers, resend requests and the queue limit. Frames are
+built here with a CRC of our own, and what the firmware sends back is parsed the same way.
+*/
+#include "testing.h"
+#include <vector>
+
+using namespace std;
+
+#define NAK_TIMEOUT 1000 //FRAME_NAK_TIMEOUT
+#define NAK_RETRIES 5 //FRAME_NAK_RETRIES
+#define QUEUE_SIZE 4096 //FRAME_QUEUE_SIZE
+
+struct Frame
+{
+	char type;
+	uint8_t seq;
+	string payload;
+};
+
+//CRC-16/CCITT, a bit at a time, to check the firmware's nibble table against.
+static uint16_t crc16( const string &data )
+{
+	uint16_t crc = 0xFFFF;
+	for ( unsigned char c : data )
+	{
+		crc ^= c << 8;
+		for ( uint8_t bit = 0; bit < 8; bit++ )
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static string frame( char type, uint8_t seq, const string &payload )
+{
+	string body = string(1, type) + static_cast<char>(seq) + static_cast<char>(payload.size() & 0xFF) + static_cast<char>(payload.size() >> 8) + payload;
+	uint16_t crc = crc16(body);
+	return '\x02' + body + static_cast<char>(crc & 0xFF) + static_cast<char>(crc >> 8);
+}
+
+//Takes the frames out of what the firmware sent the host. Anything with a bad CRC is a failure, plain text is skipped.
+static vector<Frame> parseFrames( const string &output )
+{
+	vector<Frame> frames;
+	for ( size_t pos = output.find('\x02'); pos != string::npos && pos + 7 <= output.size(); pos = output.find('\x02', pos + 1) )
+	{
+		size_t length = static_cast<uint8_t>(output[pos + 3]) | (static_cast<uint8_t>(output[pos + 4]) << 8);
+		if ( pos + 7 + length > output.size() )
+			break;
+
+		string body = output.substr(pos + 1, 4 + length);
+		uint16_t crc = static_cast<uint8_t>(output[pos + 5 + length]) | (static_cast<uint8_t>(output[pos + 6 + length]) << 8);
+		check(crc == crc16(body), "the firmware's frames have good CRCs");
+		frames.push_back({ body[0], static_cast<uint8_t>(body[1]), body.substr(4) });
+		pos += 6 + length;
+	}
+	return frames;
+}
+
+string grblInput;
+
+static vector<Frame> runMillis( uint32_t ms )
+{
+	string output;
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		nativeSetMillis(millis() + 1);
+		loop();
+		output += Serial.takeOutput();
+		grblInput += Serial2.takeOutput();
+	}
+	return parseFrames(output);
+}
+
+static vector<Frame> send( const string &data, uint32_t ms = 2 )
+{
+	Serial.inject(data);
+	return runMillis(ms);
+}
+
+static uint32_t countType( const vector<Frame> &frames, char type, int seq = -1 )
+{
+	uint32_t count = 0;
+	for ( const Frame &f : frames )
+		count += f.type == type && (seq < 0 || f.seq == seq);
+	return count;
+}
+
+static void answerLines()
+{
+	while ( linesInFlight() )
+	{
+		Serial2.inject("ok\r\n");
+		runMillis(1);
+	}
+}
+
+static void enterFramedMode()
+{
+	Serial.inject("/BIN\n");
+	runMillis(2);
+	Serial.takeOutput();
+	grblInput.clear();
+}
+
+int main()
+{
+	nativeStartFirmware();
+	enterFramedMode();
+
+	//A good frame goes through, and is acknowledged once GRBL answers
+	send(frame('D', 0, "G1 X1\n"));
+	check(grblInput == "G1 X1\n", "a good frame reaches GRBL");
+	Serial2.inject("ok\r\n");
+	vector<Frame> frames = runMillis(2);
+	check(countType(frames, 'A', 0) == 1 && frames.size() && frames.back().payload == string("\x01\x00", 2), "the ok is counted in an 'A' frame");
+
+	//A repeated frame is acknowledged again, and not used twice
+	grblInput.clear();
+	frames = send(frame('D', 0, "G1 X1\n"));
+	check(countType(frames, 'A', 0) == 1 && grblInput.empty(), "a repeated frame is acknowledged, not used");
+
+	//A damaged frame is asked for again, and again if the resend is damaged too
+	string damaged = frame('D', 1, "G1 X2\n");
+	damaged[6] ^= 0x20;
+	frames = send(damaged);
+	check(countType(frames, 'N', 1) == 1 && grblInput.empty(), "a damaged frame is asked for");
+	frames = send(damaged);
+	check(countType(frames, 'N', 1) == 1, "a damaged resend is asked for again");
+
+	//Frames that were on their way are ignored without another 'N'
+	frames = send(frame('D', 2, "G1 X3\n") + frame('D', 3, "G1 X4\n"));
+	check(frames.empty() && grblInput.empty(), "frames after the missing one are ignored quietly");
+
+	//A resend that never comes is asked for again
+	frames = runMillis(NAK_TIMEOUT + 2);
+	check(countType(frames, 'N', 1) == 1, "the 'N' is sent again when nothing arrives");
+
+	frames = send(frame('D', 1, "G1 X2\n") + frame('D', 2, "G1 X3\n"));
+	check(grblInput == "G1 X2\nG1 X3\n" && countType(frames, 'A', 2) == 1, "the resent frames go through in order");
+	answerLines();
+
+	//A host that never answers is given up on
+	frames = send(frame('D', 7, "G1 X9\n"));
+	check(countType(frames, 'N', 3) == 1, "a missing frame is asked for");
+	frames = runMillis((NAK_TIMEOUT + 2) * (NAK_RETRIES + 1));
+	check(countType(frames, 'N', 3) == NAK_RETRIES, "the 'N' is sent again a limited number of times");
+	check(!b_framedMode, "framed mode is left after the last retry");
+
+	//A frame that would overflow the queue is refused, whether it is plain or compressed
+	enterFramedMode();
+	string lines;
+	while ( lines.size() < QUEUE_SIZE - 100 )
+		lines += "G1 X1.000 Y1.000\n";
+	uint8_t seq = 0;
+	for ( size_t x = 0; x < lines.size(); x += 500 )
+		send(frame('D', seq++, lines.substr(x, 500))); //GRBL never answers, so most of it stays queued
+
+	string block = "\xFF" "G1 X1\nG1"; //eight literals, then groups of eight matches, 66 bytes each from 6 bytes back
+	for ( uint8_t x = 0; x < 2; x++ )
+		block += string("\x00\x05\xFC\x05\xFC\x05\xFC\x05\xFC\x05\xFC\x05\xFC\x05\xFC\x05\xFC", 17); //"G1 X1\n" over and over
+	frames = send(frame('Z', seq, block));
+	check(countType(frames, 'N', seq) == 1 && !countType(frames, 'A'), "a compressed frame that decodes to more than fits is refused");
+	frames = send(frame('D', seq, string(400, 'G')));
+	check(frames.empty(), "so is a data frame, quietly while the 'N' is outstanding");
+
+	answerLines(); //the queue drains into GRBL
+	grblInput.clear();
+	frames = send(frame('Z', seq, block));
+	check(countType(frames, 'A', seq) == 1 && !grblInput.compare(0, 12, "G1 X1\nG1 X1\n"), "it is taken once there is room");
+
+	return testResult();
+}
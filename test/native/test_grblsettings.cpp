@@ -0,0 +1,84 @@
+/*
+test_grblsettings - the mirror of GRBL's settings (src/grblsettings.cpp). Writes are committed by the reply to their own line, even
+with several in flight. Queries are answered from the mirror only while GRBL has nothing else to reply to, and forwarded otherwise.
+After a reset, an "ok" that can't be the reply to our own $$ doesn't make the empty mirror valid.
+*/
+#include "testing.h"
+
+using namespace std;
+
+string hostOutput, grblInput;
+
+static void runMillis( uint32_t ms )
+{
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		nativeSetMillis(millis() + 1);
+		loop();
+		hostOutput += Serial.takeOutput();
+		grblInput += Serial2.takeOutput();
+	}
+}
+
+static void fromHost( const string &data )
+{
+	hostOutput.clear();
+	grblInput.clear();
+	Serial.inject(data);
+	runMillis(2);
+}
+
+static void fromGrbl( const string &data )
+{
+	Serial2.inject(data);
+	runMillis(2);
+}
+
+static float setting( uint8_t id ){ return getGrblSetting(static_cast<GRBL_SETTING>(id), -1); }
+
+static const char *LISTING = "$0=10\r\n$110=500\r\n$111=500\r\n";
+
+int main()
+{
+	nativeStartFirmware();
+	fromGrbl("\r\nGrbl 1.1h ['$' for help]\r\n"); //GRBL announces itself, and is asked for its settings
+	fromGrbl(string(LISTING) + "ok\r\n");
+	check(b_grblSettingsValid && setting(110) == 500, "the mirror is filled on start");
+
+	//Two writes in flight, each one is settled by its own reply
+	fromHost("$110=600\n$111=700\n");
+	check(grblInput == "$110=600\n$111=700\n", "writes go to GRBL");
+	fromGrbl("ok\r\n");
+	check(setting(110) == 600 && setting(111) == 500, "the first ok commits the first write only");
+	fromGrbl("error:3\r\n");
+	check(setting(111) == 500, "a refused write leaves the mirror as it was");
+
+	//Queries wait their turn behind lines in flight
+	fromHost("G1 X1\n");
+	fromHost("$$\n");
+	check(grblInput == "$$\n", "$$ goes to GRBL while a line is in flight");
+	fromHost("$110\n");
+	check(grblInput == "$110\n", "so does $n");
+	fromHost("G1 X2\n$110\n");
+	check(grblInput == "G1 X2\n$110\n", "and $n behind a line of the same chunk");
+	fromGrbl("ok\r\n$0=10\r\n$110=600\r\n$111=500\r\nok\r\n$110=600\r\nok\r\nok\r\n$110=600\r\nok\r\n");
+	check(!linesInFlight() && hostOutput.find("$110=600") != string::npos, "GRBL's answers reach the host");
+
+	fromHost("$$\n");
+	check(grblInput.empty() && hostOutput.find("$110=600") != string::npos && hostOutput.find("ok\r\n") != string::npos,
+		  "$$ is answered from the mirror once GRBL is idle");
+	fromHost("$111\n");
+	check(grblInput.empty() && hostOutput.find("$111=500") != string::npos, "so is $n");
+
+	//After a reset, an ok for a line from before doesn't count as the reply to our $$
+	fromGrbl("\r\nGrbl 1.1h ['$' for help]\r\n");
+	check(!b_grblSettingsValid && grblInput.find("$$") != string::npos, "the settings are asked for again after a reset");
+	hostOutput.clear();
+	fromGrbl("ok\r\n");
+	check(!b_grblSettingsValid && linesInFlight() == 1, "a stray ok leaves the mirror invalid, and our $$ in flight");
+	check(hostOutput.find("ok\r\n") != string::npos, "the stray ok reaches the host");
+	fromGrbl(string(LISTING) + "ok\r\n");
+	check(b_grblSettingsValid && setting(110) == 500 && !linesInFlight(), "the real listing fills the mirror");
+
+	return testResult();
+}
@@ -0,0 +1,88 @@
+/*
+test_lzss - the decompressor for 'Z' frames (src/lzdecode.cpp), against the golden vectors in test/lzss. Each <name>.lz was made from
+<name>.txt by tools/lzss.py, and has to decode back to it whole, and cut into blocks that split items and flag groups.
+Between them the vectors have to hold a match that reaches back across the end of the window, and one that overlaps its own output.
+*/
+#include "testing.h"
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+#define WINDOW_SIZE 1024 //LZ_WINDOW_SIZE
+
+string decoded;
+
+static void sink( const uint8_t *data, uint16_t length ){ decoded.append(reinterpret_cast<const char *>(data), length); }
+
+static string readFile( const string &path )
+{
+	ifstream file(path, ios::binary);
+	stringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+//Decodes the stream in blocks of the given size, from a fresh window.
+static string decodeBlocks( const string &stream, size_t blockSize )
+{
+	resetDecompressor();
+	decoded.clear();
+	for ( size_t x = 0; x < stream.size(); x += blockSize )
+	{
+		string block = stream.substr(x, blockSize);
+		decompressBlock(reinterpret_cast<const uint8_t *>(block.data()), block.size(), sink);
+	}
+	return decoded;
+}
+
+//Walks the items of a stream, and notes which kinds of match it has.
+static void findMatches( const string &stream, bool &wraps, bool &overlaps )
+{
+	size_t out = 0;
+	for ( size_t x = 0; x < stream.size(); )
+	{
+		uint8_t flags = stream[x++];
+		for ( uint8_t bit = 0; bit < 8 && x < stream.size(); bit++ )
+		{
+			if ( flags & (1 << bit) )
+			{
+				out++;
+				x++;
+				continue;
+			}
+
+			uint8_t low = stream[x], high = stream[x + 1];
+			size_t offset = (low | ((high & 0x03) << 8)) + 1,
+				   length = (high >> 2) + 3;
+			wraps |= out >= WINDOW_SIZE && out % WINDOW_SIZE < offset;
+			overlaps |= offset < length;
+			out += length;
+			x += 2;
+		}
+	}
+}
+
+int main()
+{
+	nativeStartFirmware();
+
+	bool wraps = false, overlaps = false;
+	for ( const char *name : { "overlap", "wrap" } )
+	{
+		string text = readFile(string("test/lzss/") + name + ".txt"),
+			   stream = readFile(string("test/lzss/") + name + ".lz");
+		check(text.size() && stream.size(), string(name) + " is there");
+		findMatches(stream, wraps, overlaps);
+
+		resetDecompressor();
+		check(decompressedLength(reinterpret_cast<const uint8_t *>(stream.data()), stream.size()) == text.size(), string(name) + " is measured right");
+		check(decodeBlocks(stream, stream.size()) == text, string(name) + " decodes as a single block");
+		for ( size_t blockSize : { 1, 2, 7, 64 } )
+			check(decodeBlocks(stream, blockSize) == text, string(name) + " decodes in blocks of " + to_string(blockSize));
+	}
+	check(wraps, "a match reaches back across the end of the window");
+	check(overlaps, "a match overlaps its own output");
+
+	return testResult();
+}
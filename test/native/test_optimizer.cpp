@@ -0,0 +1,75 @@
+/*
+test_optimizer - the segment optimizer (src/optimizer.cpp). Nearly collinear G1 moves are joined while every point stays within
+OPTTOL, up to OPT_WINDOW of them and at the same feed. Anything else goes out as it arrived, after the moves that were held, and the
+host gets an "ok" for every one of its lines.
+*/
+#include "testing.h"
+
+using namespace std;
+
+string hostOutput, grblInput;
+uint32_t hostLines;
+
+static void runMillis( uint32_t ms )
+{
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		nativeSetMillis(millis() + 1);
+		loop();
+		hostOutput += Serial.takeOutput();
+		grblInput += Serial2.takeOutput();
+	}
+}
+
+//Sends lines from the host, GRBL doesn't answer them yet. Returns what went on to GRBL.
+static string send( const string &lines )
+{
+	for ( char c : lines )
+		hostLines += c == '\n';
+	grblInput.clear();
+	Serial.inject(lines);
+	runMillis(2);
+	return grblInput;
+}
+
+static uint32_t countOks( const string &output )
+{
+	uint32_t oks = 0;
+	for ( size_t pos = output.find("ok\r\n"); pos != string::npos; pos = output.find("ok\r\n", pos + 1) )
+		oks++;
+	return oks;
+}
+
+int main()
+{
+	nativeStartFirmware();
+	Serial.inject("/OPTTOL=5\n");
+	runMillis(2);
+	Serial.inject("/OPT=1\n");
+	runMillis(2);
+	hostOutput.clear();
+
+	check(send("G21 G90 G94\nG1 X0 Y0 Z0 F1000\n") == "G21 G90 G94\nG1 X0 Y0 Z0 F1000\n", "lines from an unknown position go out as they are");
+	check(send("G1 X1 Y0.001\nG1 X2 Y0.002\nG1 X3 Y0\nG1 X3 Y5\n") == "X3Y0\n", "moves within the tolerance are joined, and held until a corner");
+	check(send("G1 X4 Y5.01\nG1 X5 Y5\n") == "X3Y5\nX4Y5.01\n", "a point 10 um off the joined move is not joined");
+	check(send("G1 X6 Y5 F500\n") == "X5Y5\n", "a move at another feed is not joined");
+
+	string window;
+	for ( uint8_t x = 7; x <= 16; x++ )
+		window += "G1 X" + to_string(x) + " Y5\n";
+	check(send(window) == "X13Y5F500\n", "no more than 8 moves are joined");
+	check(send("M5\n") == "X16Y5\nM5\n", "other lines go out after the held moves");
+	check(send("G91\nG1 X1\nG1 X1\nG90\n") == "G91\nG1 X1\nG1 X1\nG90\n", "relative moves are not joined");
+
+	check(send("G1 X20 Y5\n").empty(), "a move is held while GRBL has lines to work on");
+	grblInput.clear();
+	while ( linesInFlight() ) //the held move goes out along the way, and is answered as well
+	{
+		Serial2.inject("ok\r\n");
+		runMillis(2);
+	}
+	check(grblInput == "X20Y5\n", "and goes out once it has none");
+	check(countOks(hostOutput) == hostLines, "the host gets an ok for every one of its lines");
+
+	return testResult();
+}
@@ -0,0 +1,78 @@
+/*
+test_preflight - the work envelope and soft limit check of the pre-flight analyzer (src/preflight.cpp). The envelope covers every
+point a move reaches, arcs included, in mm whatever units the job uses. It is checked against the travel once GRBL has reported its
+work offset, and only by size before that. Lines GRBL would reject are counted, none of the job reaches GRBL.
+*/
+#include "testing.h"
+
+using namespace std;
+
+string grblInput;
+
+static string command( const string &data )
+{
+	Serial.inject(data);
+	nativeRunMillis(2);
+	grblInput += Serial2.takeOutput();
+	return Serial.takeOutput();
+}
+
+static string preflight( const string &job )
+{
+	command("/PF\n");
+	command(job);
+	return command("/PFE\n");
+}
+
+static bool has( const string &report, const string &text )
+{
+	if ( report.find(text) != string::npos )
+		return true;
+
+	cout << "Missing \"" << text << "\" in:" << endl << report;
+	return false;
+}
+
+int main()
+{
+	nativeStartFirmware();
+
+	string report = preflight("G21 G90\nG0 X-5 Y2 Z0\nG1 X10 Y-3 Z-1 F500\nG91 G1 X2 Y-1\nM30\n");
+	check(has(report, "Envelope X -5.000 to 12.000 mm, Y -4.000 to 2.000 mm, Z -1.000 to 0.000 mm"), "straight moves, absolute and relative");
+	check(has(report, "soft limits not checked (no travel known)"), "no travel, no check");
+	check(grblInput.empty(), "nothing of the job reaches GRBL");
+
+	report = preflight("G21 G90 G17\nG0 X10 Y0 Z0\nG2 X-10 Y0 I-10 J0 F500\nM30\n");
+	check(has(report, "X -10.000 to 10.000 mm, Y -10.000 to 0.000 mm"), "a clockwise arc reaches down to where it crosses the Y axis");
+	report = preflight("G21 G90 G17\nG0 X10 Y0 Z0\nG3 X-10 Y0 R10 F500\nM30\n");
+	check(has(report, "0.000 to 10.000 mm, Z"), "a counterclockwise arc by its radius reaches up");
+
+	report = preflight("G20 G90\nG0 X0 Y0 Z0\nG1 X1 Y-0.5 F20\nM30\n");
+	check(has(report, "X 0.000 to 25.400 mm, Y -12.700 to 0.000 mm"), "inches are reported in mm");
+
+	command("/SLX=100\n");
+	command("/SLY=100\n");
+	command("/SLZ=50\n");
+	string job = "G21 G90\nG0 X0 Y0 Z0\nG1 X120 Y50 Z-10 F500\nM30\n";
+	report = preflight(job);
+	check(has(report, "soft limits X beyond by 20.000 mm (size only, no work offset from GRBL yet)"), "without a work offset only the size is checked");
+
+	//GRBL keeps the machine between -travel and 0, X fits, Y goes over the top, Z below the bottom
+	Serial2.inject("<Idle|MPos:-95.000,-30.000,-45.000|FS:0,0|WCO:-95.000,-30.000,-45.000>\r\n");
+	nativeRunMillis(2);
+	job = "G21 G90\nG0 X0 Y0 Z0\nG1 X90 Y50 Z-10 F500\nM30\n";
+	report = preflight(job);
+	check(has(report, "soft limits Y beyond by 20.000 mm, Z beyond by 5.000 mm\n"), "the envelope is moved by the work offset");
+
+	Serial2.inject("<Idle|MPos:-50.000,-50.000,-20.000|FS:0,0|WCO:-50.000,-50.000,-20.000>\r\n");
+	nativeRunMillis(2);
+	report = preflight(job);
+	check(has(report, "soft limits X beyond by 40.000 mm\n"), "the same job is checked again once the offset changes");
+	report = preflight("G21 G90\nG0 X0 Y0 Z0\nG1 X-10 Y10 Z-10 F500\nM30\n");
+	check(has(report, "soft limits ok\n"), "an envelope inside the travel is ok");
+
+	report = preflight("G21 G90\nG0 X0 Y0 Z0\nG1 X1 Q5\nG4 P1\nG66\nM30\n");
+	check(has(report, "Rejected lines: 2"), "lines GRBL would reject are counted");
+
+	return testResult();
+}
@@ -0,0 +1,132 @@
+/*
+test_stall - checks when the ack tracker (src/acktracker.cpp) declares that GRBL has stalled. A line that waits behind a long move or
+a dwell is not a stall as long as GRBL answers a status request, and is busy or moving. A GRBL that doesn't answer, or that says it
+is running without moving, is. Only then is it held (STALLA=4), and our own status requests never reach the host.
+*/
+#include "testing.h"
+
+using namespace std;
+
+#define STALL_MSEC 2000
+
+//GRBL, answering status requests the way the test wants, and every line only when the test says so.
+struct SimulatedGrbl
+{
+	const char *state = "Idle";
+	bool b_answers = true,
+		 b_moving = false;
+	float f_x = 0;
+	uint32_t i_queries = 0, //'?' received
+			 i_holds = 0; //'!' received
+
+	void service()
+	{
+		for ( char c : Serial2.takeOutput() )
+		{
+			if ( c == '!' )
+				i_holds++;
+			if ( c != '?' )
+				continue;
+
+			i_queries++;
+			if ( !b_answers )
+				continue;
+
+			if ( b_moving )
+				f_x += 0.5f;
+			char report[64];
+			snprintf(report, sizeof(report), "<%s|MPos:%.3f,0.000,0.000|FS:500,0>\r\n", state, f_x);
+			Serial2.inject(report);
+		}
+	}
+};
+
+SimulatedGrbl grbl;
+string hostOutput;
+
+static void runMillis( uint32_t ms )
+{
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		nativeSetMillis(millis() + 1);
+		loop();
+		grbl.service();
+		hostOutput += Serial.takeOutput();
+	}
+}
+
+//Answers every line in flight, and lets a while pass, so that nothing is left of the previous case.
+static void settle()
+{
+	while ( linesInFlight() )
+	{
+		Serial2.inject("ok\r\n");
+		runMillis(1);
+	}
+	runMillis(STALL_MSEC * 2);
+	grbl = SimulatedGrbl();
+	hostOutput.clear();
+}
+
+//Sends a line that GRBL holds on to for ms, as it does behind a long move or during a dwell.
+static void holdLine( const char *line, uint32_t ms, uint32_t pollMillis = 0 )
+{
+	Serial.inject(line);
+	uint32_t start = millis();
+	while ( millis() - start < ms )
+	{
+		if ( pollMillis && (millis() - start) % pollMillis == 0 )
+			Serial.inject("?");
+		runMillis(1);
+	}
+	Serial2.inject("ok\r\n");
+	runMillis(5);
+}
+
+static bool stalled(){ return hostOutput.find("[MSG:No reply from GRBL") != string::npos; }
+
+int main()
+{
+	nativeStartFirmware();
+	Serial.inject("/STALL=" + to_string(STALL_MSEC) + "\n");
+	runMillis(5);
+	Serial.inject("/STALLA=5\n");
+	runMillis(5);
+
+	settle();
+	grbl.state = "Run";
+	grbl.b_moving = true;
+	holdLine("G1 X500 F100\n", STALL_MSEC * 5);
+	check(!stalled() && !grbl.i_holds, "a long move that GRBL is making is not a stall");
+	check(grbl.i_queries >= 2 && hostOutput.find('<') == string::npos, "GRBL is asked, the host doesn't see the answers");
+
+	settle();
+	holdLine("G4 P10\n", STALL_MSEC * 5);
+	check(!stalled() && !grbl.i_holds, "a dwell is not a stall");
+
+	settle();
+	grbl.state = "Run";
+	grbl.b_moving = true;
+	holdLine("G1 X500 F100\n", STALL_MSEC * 5, 200);
+	check(!stalled() && grbl.i_queries == STALL_MSEC * 5 / 200, "the host's own status polls are enough, GRBL isn't asked again");
+	check(hostOutput.find('<') != string::npos, "the host gets the reports it asked for");
+
+	settle();
+	grbl.b_answers = false;
+	Serial.inject("G1 X1\n");
+	runMillis(STALL_MSEC + 900);
+	check(!stalled() && grbl.i_queries == 1, "GRBL gets time to answer before it is stuck");
+	runMillis(200);
+	check(stalled() && grbl.i_holds == 1, "GRBL that doesn't answer has stalled, and is held");
+
+	settle();
+	grbl.state = "Run";
+	Serial.inject("G1 X1\n");
+	runMillis(STALL_MSEC * 3);
+	check(stalled() && grbl.i_holds == 1, "GRBL that is running without moving has stalled");
+	Serial2.inject("ok\r\n");
+	runMillis(5);
+	check(hostOutput.find("[MSG:GRBL is responding again]") != string::npos, "the stall clears with the next ok");
+
+	return testResult();
+}
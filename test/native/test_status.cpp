@@ -0,0 +1,68 @@
+/*
+test_status - the status report parser and history rings (src/telemetry.cpp). Every field GRBL may send is parsed into grblStatus,
+the position GRBL leaves out is worked out from the offset, and the history keeps one sample per interval up to its size.
+*/
+#include "testing.h"
+#include <cmath>
+
+using namespace std;
+
+static bool near( float a, float b ){ return fabsf(a - b) < 0.0005f; }
+
+static void report( const char *msg, uint32_t ms = 1 )
+{
+	nativeSetMillis(millis() + ms);
+	parseStatusReport(msg);
+}
+
+static string history()
+{
+	Serial.takeOutput();
+	printHistory();
+	return Serial.takeOutput();
+}
+
+int main()
+{
+	nativeStartFirmware();
+
+	//Every field
+	report("<Run|MPos:1.000,-2.500,3.125|Bf:15,128|FS:500,12000|Ov:110,50,90|Pn:XZP>");
+	check(grblStatus.state == GRBL_STATE::RUN, "the state");
+	check(near(grblStatus.f_mpos[0], 1) && near(grblStatus.f_mpos[1], -2.5f) && near(grblStatus.f_mpos[2], 3.125f), "the machine position");
+	check(grblStatus.i_bufferBlocks == 15 && grblStatus.i_bufferBytes == 128, "the buffer");
+	check(near(grblStatus.f_feed, 500) && near(grblStatus.f_spindle, 12000), "feed and spindle");
+	check(grblStatus.i_ovFeed == 110 && grblStatus.i_ovRapid == 50 && grblStatus.i_ovSpindle == 90, "the overrides");
+	check(grblStatus.i_pins == 0x0D, "the pins");
+	check(grblStatus.i_updateMillis == millis(), "the time of the report");
+
+	//The offset comes now and then, the other position is worked out from it
+	report("<Idle|MPos:10.000,20.000,30.000|FS:0,0|WCO:1.000,2.000,3.000>");
+	check(near(grblStatus.f_wpos[0], 9) && near(grblStatus.f_wpos[1], 18) && near(grblStatus.f_wpos[2], 27), "the work position from MPos and WCO");
+	check(!grblStatus.i_pins, "the pins are cleared when not reported");
+	report("<Jog|WPos:0.000,0.000,-1.000|F:250>");
+	check(grblStatus.state == GRBL_STATE::JOG && near(grblStatus.f_mpos[2], 2), "the machine position from WPos and the last WCO");
+	check(near(grblStatus.f_feed, 250) && near(grblStatus.f_spindle, 0), "a feed without a spindle speed");
+
+	//Broken fields are skipped, the rest is kept
+	report("<Hold:0|MPos:1.000,2.000|Bf:7,99|Ov:100>");
+	check(grblStatus.state == GRBL_STATE::HOME_HOLD && near(grblStatus.f_mpos[2], 2) && grblStatus.i_bufferBlocks == 7, "incomplete fields are skipped");
+	check(grblStatus.i_ovFeed == 110, "and the values from before are kept");
+	report("ok");
+	check(grblStatus.i_bufferBlocks == 7, "anything but a report is ignored");
+
+	//The fine ring keeps one sample per 100 msec, the coarse one per 10 sec
+	string before = history();
+	for ( uint16_t x = 0; x < 40; x++ )
+		report("<Run|MPos:5.000,0.000,0.000|FS:100,0>", 50);
+	check(before.find("[HIST:F:1:") != string::npos && history().find("[HIST:F:21:") != string::npos, "one fine sample per 100 msec");
+
+	//Full rings drop their oldest sample
+	for ( uint16_t x = 0; x < 800; x++ )
+		report(x % 2 ? "<Run|MPos:5.000,0.000,0.000|FS:100,0>" : "<Run|MPos:6.000,0.000,0.000|FS:100,0>", 100);
+	string full = history();
+	check(full.find("[HIST:F:600:") != string::npos, "the fine ring stops at 600 samples");
+	check(full.find("[HIST:C:") != string::npos && full.find("[HIST:C:1:") == string::npos, "the coarse ring has a sample per 10 sec");
+
+	return testResult();
+}
@@ -0,0 +1,286 @@
+/*
+test_websocket - streams the same job through the firmware twice, first with nobody watching, then with three WebSocket watchers
+reading the telemetry and one that never reads, and checks that the job goes exactly the same way both times. The watchers
+connect over real loopback sockets, GRBL and the host are simulated on the virtual clock.
+
+Also checks that WiFi stays off while a Bluetooth host is connected unless WSBT=1, and that the WiFi password never shows in $$,
+in the reply to setting it, or in a capture.
+
+Prints the time loop() took per cycle in both runs. That is CPU time on this machine only, what WiFi costs the Bluetooth link on
+the ESP-32 (they share the radio) can't be measured here, see src/websocket.cpp.
+*/
+#include "testing.h"
+#include <WiFi.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+
+using namespace std;
+
+#define JOB_LINES 3000
+#define LINES_IN_FLIGHT 3 //kept in GRBL's buffer by the simulated host
+#define GRBL_LINE_MSEC 2 //time GRBL takes to answer a line
+#define POLL_MSEC 2 //between status polls from the host, each one is a telemetry update
+#define WATCHERS 4 //the last one never reads
+#define MAX_ADDED_NANOS 50000 //most that the watchers may add to the average loop() on this machine, a guard against regressions
+
+//GRBL, as far as the firmware can tell: an ok for every line after a little while, and a status report for every poll.
+struct SimulatedGrbl
+{
+	deque<uint32_t> okMillis; //when each pending ok is due
+	float f_x = 0;
+
+	void receive( const string &data )
+	{
+		for ( char c : data )
+		{
+			if ( c == '?' )
+			{
+				char report[96];
+				snprintf(report, sizeof(report), "<Run|MPos:%.3f,0.000,0.000|FS:1000,0|Bf:%u,100>\r\n", f_x, static_cast<unsigned>(15 - okMillis.size()));
+				Serial2.inject(report);
+			}
+			else if ( c == '\n' )
+			{
+				okMillis.push_back(max(okMillis.size() ? okMillis.back() : 0, millis()) + GRBL_LINE_MSEC);
+				f_x += 0.1f;
+			}
+		}
+	}
+
+	void service()
+	{
+		while ( okMillis.size() && okMillis.front() <= millis() )
+		{
+			Serial2.inject("ok\r\n");
+			okMillis.pop_front();
+		}
+	}
+};
+
+struct JobResult
+{
+	uint32_t i_millis, //on the virtual clock, from the first line to the last ok
+			 i_oks;
+	uint64_t i_cycles,
+			 i_loopNanos; //real time spent in loop()
+};
+
+SimulatedGrbl grbl;
+
+//One msec of the virtual clock, with one loop() that is timed.
+static uint64_t runCycle()
+{
+	nativeSetMillis(millis() + 1);
+	grbl.service();
+
+	auto start = chrono::steady_clock::now();
+	loop();
+	uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+	grbl.receive(Serial2.takeOutput());
+	return nanos;
+}
+
+static void runMillis( uint32_t ms, HardwareSerial &host = Serial )
+{
+	for ( uint32_t x = 0; x < ms; x++ )
+	{
+		runCycle();
+		host.takeOutput();
+	}
+}
+
+static void sendCommand( const string &command, HardwareSerial &host = Serial )
+{
+	host.inject(command + "\n");
+	runMillis(5, host);
+}
+
+//A WebSocket client, just enough of one to count the messages it gets.
+struct Watcher
+{
+	int i_socket = -1;
+	string s_received;
+	uint32_t i_messages = 0;
+
+	bool connectTo( uint16_t port, int receiveBuffer )
+	{
+		i_socket = socket(AF_INET, SOCK_STREAM, 0);
+		if ( receiveBuffer )
+			setsockopt(i_socket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ( connect(i_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 )
+			return false;
+
+		string request = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+						 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+		send(i_socket, request.data(), request.size(), 0);
+
+		for ( uint8_t x = 0; x < 50 && s_received.find("\r\n\r\n") == string::npos; x++ )
+		{
+			runMillis(1);
+			receive();
+		}
+
+		size_t end = s_received.find("\r\n\r\n");
+		bool upgraded = !s_received.compare(0, 12, "HTTP/1.1 101") && s_received.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") < end;
+		s_received.erase(0, end == string::npos ? s_received.size() : end + 4);
+		return upgraded;
+	}
+
+	//Takes whatever has arrived, and counts the complete messages (all of them short text frames).
+	void receive()
+	{
+		char data[4096];
+		ssize_t length;
+		while ( (length = recv(i_socket, data, sizeof(data), MSG_DONTWAIT)) > 0 )
+			s_received.append(data, length);
+
+		while ( s_received.size() >= 2 && s_received.find("\r\n\r\n") == string::npos )
+		{
+			size_t payload = static_cast<uint8_t>(s_received[1]) & 0x7F, header = 2;
+			if ( payload == 126 )
+			{
+				if ( s_received.size() < 4 )
+					break;
+				payload = (static_cast<uint8_t>(s_received[2]) << 8) | static_cast<uint8_t>(s_received[3]);
+				header = 4;
+			}
+			if ( s_received.size() < header + payload )
+				break;
+
+			s_received.erase(0, header + payload);
+			i_messages++;
+		}
+	}
+
+	~Watcher()
+	{
+		if ( i_socket >= 0 )
+			close(i_socket);
+	}
+};
+
+static uint32_t countOks( const string &output )
+{
+	uint32_t oks = 0;
+	for ( size_t pos = output.find("ok\r\n"); pos != string::npos; pos = output.find("ok\r\n", pos + 1) )
+		oks++;
+	return oks;
+}
+
+//Streams the job, the first reading watchers take what they are sent once per cycle.
+static JobResult streamJob( Watcher *watchers = nullptr, uint8_t reading = 0 )
+{
+	JobResult result = {};
+	uint32_t sent = 0, startMillis = millis(), nextPoll = millis();
+	Serial.takeOutput();
+
+	while ( result.i_oks < JOB_LINES && millis() - startMillis < JOB_LINES * 10 )
+	{
+		if ( sent < JOB_LINES && sent - result.i_oks < LINES_IN_FLIGHT )
+		{
+			Serial.inject("G1 X" + to_string(sent % 100) + " F1000\n");
+			sent++;
+		}
+		else if ( millis() >= nextPoll )
+		{
+			Serial.inject("?");
+			nextPoll = millis() + POLL_MSEC;
+		}
+
+		result.i_loopNanos += runCycle();
+		result.i_cycles++;
+		result.i_oks += countOks(Serial.takeOutput());
+		for ( uint8_t x = 0; x < reading; x++ )
+			watchers[x].receive();
+	}
+
+	result.i_millis = millis() - startMillis;
+	runMillis(10); //the last poll is answered
+	return result;
+}
+
+static void printJob( const char *name, const JobResult &job )
+{
+	cout << name << ": " << job.i_oks << " oks in " << job.i_millis << " msec, " << job.i_cycles << " cycles, "
+		 << job.i_loopNanos / max<uint64_t>(job.i_cycles, 1) << " ns per loop()" << endl;
+}
+
+int main()
+{
+	nativeStartFirmware();
+	sendCommand("/SSID=test");
+	sendCommand("/WSINT=" + to_string(POLL_MSEC));
+
+	JobResult unwatched = streamJob();
+	printJob("Unwatched", unwatched);
+
+	sendCommand("/WS=1");
+	check(WiFi.getMode() == WIFI_STA, "WiFi comes on with WS=1 and an SSID");
+
+	Watcher watchers[WATCHERS];
+	for ( uint8_t x = 0; x < WATCHERS; x++ )
+		check(watchers[x].connectTo(WS_PORT, x == WATCHERS - 1 ? 1024 : 0), "watcher " + to_string(x) + " is upgraded");
+
+	JobResult watched = streamJob(watchers, WATCHERS - 1);
+	printJob("Watched", watched);
+
+	check(watched.i_oks == JOB_LINES && unwatched.i_oks == JOB_LINES, "every line of both jobs is answered");
+	check(watched.i_millis == unwatched.i_millis, "the watchers don't change how long the job takes");
+	check(watched.i_loopNanos / watched.i_cycles < unwatched.i_loopNanos / unwatched.i_cycles + MAX_ADDED_NANOS,
+		  "the watchers add less than " + to_string(MAX_ADDED_NANOS) + " ns to the average loop()");
+
+	for ( uint8_t x = 0; x < WATCHERS - 1; x++ )
+		check(watchers[x].i_messages > JOB_LINES * GRBL_LINE_MSEC / POLL_MSEC / 4, "watcher " + to_string(x) + " gets updates during the job");
+
+	watchers[WATCHERS - 1].receive(); //everything that was waiting for it
+	cout << "Messages per watcher:";
+	for ( Watcher &watcher : watchers )
+		cout << ' ' << watcher.i_messages;
+	cout << endl;
+	check(watchers[WATCHERS - 1].i_messages < watchers[0].i_messages, "the watcher that never reads is skipped, not waited for");
+
+	//WiFi shares the radio with Bluetooth, it goes off while a Bluetooth host is connected
+	BtSerial.setClient(true);
+	runMillis(5, BtSerial);
+	check(WiFi.getMode() == WIFI_OFF, "WiFi goes off while a Bluetooth host is connected");
+	sendCommand("/WSBT=1", BtSerial);
+	check(WiFi.getMode() == WIFI_STA, "WSBT=1 keeps WiFi on with a Bluetooth host");
+	sendCommand("/WSBT=0", BtSerial);
+	BtSerial.setClient(false);
+	runMillis(5);
+	check(WiFi.getMode() == WIFI_STA, "WiFi comes back once the Bluetooth host is gone");
+
+	//The password is never shown
+	sendCommand("/WPASS=hunter22");
+	string output;
+	for ( const char *command : { "/WPASS=hunter22\n", "$$\n" } )
+	{
+		Serial.inject(command);
+		runCycle();
+		output += Serial.takeOutput();
+	}
+	check(output.find("hunter22") == string::npos && output.find("WPASS set to: ********") != string::npos, "the password is masked");
+	check(s_wifiPassword == "hunter22", "the password is kept");
+	check(settingsText(true).indexOf("hunter22") < 0 && settingsText().indexOf("hunter22") >= 0, "the password is left out of captures, not the settings file");
+
+	sendCommand("/CAP=1");
+	sendCommand("/WPASS=hunter22");
+	sendCommand("/CAP=0");
+	File file = SPIFFS.open("/capture.bin", FILE_READ);
+	string capture;
+	for ( int c; (c = file.read()) >= 0; )
+		capture += static_cast<char>(c);
+	check(capture.size() && capture.find("hunter22") == string::npos && capture.find("/WPASS=********") != string::npos, "the password is masked in captures");
+
+	return testResult();
+}
@@ -0,0 +1,26 @@
+/*
+What the tests in test/native share. Each test is a program of its own: it drives the firmware on the virtual clock, checks what
+it sees with check(), and returns testResult() from main().
+*/
+#pragma once
+#include "globaldefs.h"
+#include <native.h>
+#include <iostream>
+#include <string>
+
+static int failures;
+
+static void check( bool condition, const std::string &what )
+{
+	if ( !condition )
+	{
+		std::cout << "FAIL: " << what << std::endl;
+		failures++;
+	}
+}
+
+static int testResult()
+{
+	std::cout << (failures ? "FAILED" : "PASSED") << std::endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+/*
+cnc_bench - runs the /BENCH microbenchmarks (see src/benchmark.cpp) against the firmware built for Linux, and prints their report.
+Exits with 0 only if every result has a baseline in src/bench_baseline.h and none of them regressed.
+*/
+#include "globaldefs.h"
+#include <native.h>
+#include <iostream>
+
+int main()
+{
+	nativeStartFirmware();
+
+	bool passed = runBenchmarks();
+	std::cout << Serial.takeOutput();
+	return passed ? 0 : 1;
+}
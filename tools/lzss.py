@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""
+lzss.py - reference encoder for the compressed 'Z' frames (see src/lzdecode.cpp for the format), and the golden vectors in test/lzss.
+
+    lzss.py <input> <output>       compresses a file, the output is one stream that may be cut into blocks anywhere
+    lzss.py -d <input> <output>    decompresses a stream
+    lzss.py --check <directory>    checks that every <name>.lz there is what <name>.txt compresses to, and decompresses back to it
+
+The encoder is greedy and plain on purpose: at every position it takes the longest match in the window, the nearest one of that
+length, and a literal if there is none of at least 3 bytes. Matches may run on into the bytes they produce (offset < length).
+"""
+import os
+import sys
+
+WINDOW_SIZE = 1024
+MIN_MATCH = 3
+MAX_MATCH = 66
+
+
+def encode(data):
+    items = []
+    pos = 0
+    while pos < len(data):
+        best_length, best_offset = 0, 0
+        for offset in range(1, min(WINDOW_SIZE, pos) + 1):
+            length = 0
+            while length < MAX_MATCH and pos + length < len(data) and data[pos + length - offset] == data[pos + length]:
+                length += 1
+            if length > best_length:
+                best_length, best_offset = length, offset
+
+        if best_length >= MIN_MATCH:
+            low = best_offset - 1
+            items.append(bytes([low & 0xFF, (low >> 8) | ((best_length - MIN_MATCH) << 2)]))
+            pos += best_length
+        else:
+            items.append(data[pos:pos + 1])
+            pos += 1
+
+    out = bytearray()
+    for group in range(0, len(items), 8):
+        flags = 0
+        for bit, item in enumerate(items[group:group + 8]):
+            if len(item) == 1:
+                flags |= 1 << bit
+        out.append(flags)
+        for item in items[group:group + 8]:
+            out += item
+    return bytes(out)
+
+
+def decode(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if pos >= len(data):
+                break
+            if flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+                continue
+
+            offset = (data[pos] | ((data[pos + 1] & 0x03) << 8)) + 1
+            length = (data[pos + 1] >> 2) + MIN_MATCH
+            pos += 2
+            for _ in range(length):
+                out.append(out[-offset])
+    return bytes(out)
+
+
+def check(directory):
+    failed = 0
+    names = sorted(name[:-3] for name in os.listdir(directory) if name.endswith('.lz'))
+    for name in names:
+        with open(os.path.join(directory, name + '.txt'), 'rb') as text, open(os.path.join(directory, name + '.lz'), 'rb') as stream:
+            data, golden = text.read(), stream.read()
+        good = encode(data) == golden and decode(golden) == data
+        print('%s: %d -> %d bytes, %s' % (name, len(data), len(golden), 'ok' if good else 'DIFFERS'))
+        failed += not good
+    return 1 if failed or not names else 0
+
+
+def main(args):
+    if len(args) == 2 and args[0] == '--check':
+        return check(args[1])
+
+    decompress = len(args) == 3 and args[0] == '-d'
+    if len(args) != 2 and not decompress:
+        sys.stderr.write(__doc__)
+        return 2
+
+    with open(args[-2], 'rb') as source:
+        data = source.read()
+    with open(args[-1], 'wb') as target:
+        target.write(decode(data) if decompress else encode(data))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
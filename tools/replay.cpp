@@ -0,0 +1,201 @@
+/*
+cnc_replay - replays a session captured on the ESP-32 (see src/capture.cpp and src/replay.cpp) against the firmware built for Linux.
+
+    cnc_replay <capture>                     replays a capture, exits with 0 only if everything the firmware sent out matched
+    cnc_replay --record <session> <capture>  runs a scripted session through the firmware and captures it
+
+The capture is either the file itself (/capture.bin) or a log of the host's side of /CAPDUMP, [CAP:...] lines in among anything else.
+
+A session script (test/captures/*.session) has one chunk per line, what arrives from the host or from GRBL, after a delay:
+    <msec since the previous chunk> host|grbl <data>
+The data may hold \n, \r, \t, \\ and \xNN escapes. Lines starting with # are comments. The captures in test/captures are
+recorded from the scripts next to them, and are recorded again when a change to the firmware is meant to change what it sends.
+*/
+#include "globaldefs.h"
+#include <native.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+static bool readFile( const string &path, string &data )
+{
+	ifstream file(path, ios::binary);
+	if ( !file )
+		return false;
+
+	stringstream contents;
+	contents << file.rdbuf();
+	data = contents.str();
+	return true;
+}
+
+static string base64Decode( const string &text )
+{
+	string out;
+	uint32_t bits = 0;
+	int count = 0;
+	for ( char c : text )
+	{
+		const char *digit = strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/", c);
+		if ( c == '=' || !c || !digit )
+			break;
+
+		bits = (bits << 6) | (digit - "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+		count += 6;
+		if ( count >= 8 )
+		{
+			count -= 8;
+			out += static_cast<char>(bits >> count);
+		}
+	}
+	return out;
+}
+
+//Takes the capture out of a /CAPDUMP log, and checks it against the END line.
+static bool readCaptureDump( const string &log, string &capture )
+{
+	istringstream lines(log);
+	string line;
+	while ( getline(lines, line) )
+	{
+		size_t start = line.find("[CAP:"), end = line.find(']', start);
+		if ( start == string::npos || end == string::npos )
+			continue;
+
+		string data = line.substr(start + 5, end - start - 5);
+		if ( data.compare(0, 4, "END ") )
+		{
+			capture += base64Decode(data);
+			continue;
+		}
+
+		unsigned long size = 0, crc = 0;
+		sscanf(data.c_str() + 4, "%lu %lx", &size, &crc);
+		uint32_t actual = ~crc32Update(0xFFFFFFFF, reinterpret_cast<const uint8_t *>(capture.data()), capture.size());
+		if ( size != capture.size() || crc != actual )
+		{
+			cerr << "The dump is damaged: " << capture.size() << " bytes with CRC " << hex << actual << ", expected " << dec << size
+				 << " bytes with CRC " << hex << crc << endl;
+			return false;
+		}
+		return true;
+	}
+
+	cerr << "The dump has no [CAP:END] line." << endl;
+	return false;
+}
+
+static string unescape( const string &text )
+{
+	string out;
+	for ( size_t x = 0; x < text.size(); x++ )
+	{
+		if ( text[x] != '\\' || x + 1 == text.size() )
+		{
+			out += text[x];
+			continue;
+		}
+
+		char c = text[++x];
+		if ( c == 'n' )
+			out += '\n';
+		else if ( c == 'r' )
+			out += '\r';
+		else if ( c == 't' )
+			out += '\t';
+		else if ( c == 'x' && x + 2 < text.size() )
+		{
+			out += static_cast<char>(stoi(text.substr(x + 1, 2), nullptr, 16));
+			x += 2;
+		}
+		else
+			out += c;
+	}
+	return out;
+}
+
+static int recordSession( const string &scriptPath, const string &capturePath )
+{
+	string script;
+	if ( !readFile(scriptPath, script) )
+	{
+		cerr << "Can't read " << scriptPath << endl;
+		return 2;
+	}
+
+	nativeStartFirmware();
+	Serial.inject("/CAP=1\n");
+	loop();
+
+	istringstream lines(script);
+	string line;
+	for ( int number = 1; getline(lines, line); number++ )
+	{
+		if ( line.empty() || line[0] == '#' )
+			continue;
+
+		istringstream fields(line);
+		uint32_t delay;
+		string port;
+		if ( !(fields >> delay >> port) || (port != "host" && port != "grbl") )
+		{
+			cerr << scriptPath << ":" << number << ": expected <msec> host|grbl <data>" << endl;
+			return 2;
+		}
+
+		string data;
+		getline(fields >> ws, data);
+		nativeRunMillis(delay);
+		(port == "host" ? Serial : Serial2).inject(unescape(data));
+		loop();
+	}
+
+	Serial.inject("/CAP=0\n");
+	loop();
+	cout << escapeBytes(Serial.takeOutput()) << endl;
+
+	File file = SPIFFS.open(PSTR("/capture.bin"), FILE_READ);
+	string capture;
+	for ( int c; (c = file.read()) >= 0; )
+		capture += static_cast<char>(c);
+
+	ofstream out(capturePath, ios::binary);
+	out << capture;
+	return out && capture.size() ? 0 : 2;
+}
+
+int main( int argc, char **argv )
+{
+	if ( argc == 4 && string(argv[1]) == "--record" )
+		return recordSession(argv[2], argv[3]);
+
+	if ( argc != 2 )
+	{
+		cerr << "usage: cnc_replay <capture.bin|capdump.log>" << endl
+			 << "       cnc_replay --record <script.session> <capture.bin>" << endl;
+		return 2;
+	}
+
+	string capture;
+	if ( !readFile(argv[1], capture) )
+	{
+		cerr << "Can't read " << argv[1] << endl;
+		return 2;
+	}
+
+	if ( capture.find("[CAP:END ") != string::npos ) //a capture never holds a dump, one can't be started while capturing
+	{
+		string log;
+		log.swap(capture);
+		if ( !readCaptureDump(log, capture) )
+			return 2;
+	}
+
+	nativeStartFirmware();
+	String report;
+	bool matched = replayCapture(vector<uint8_t>(capture.begin(), capture.end()), report);
+	cout << argv[1] << ": " << report.c_str() << endl;
+	return matched ? 0 : 1;
+}